@@ -1,4 +1,5 @@
 #include <Arduino.h>
+#include <Preferences.h>
 #include <WiFi.h>
 #include <driver/i2c_master.h>
 #include <driver/spi_common.h>
@@ -368,6 +369,58 @@ void PrintMemInfo() {
   }
 }
 #endif
+
+// Set before the first event, then touched by the Arduino event task only.
+bool g_wifi_directed = false;
+bool g_wifi_associated = false;
+
+// Associates directly with the access point of the last connection, BSSID and channel kept in NVS, instead of scanning every
+// channel; a failed attempt drops them and scans.
+void WifiBegin() {
+  WiFi.onEvent([](arduino_event_id_t event, arduino_event_info_t info) {
+    if (event == ARDUINO_EVENT_WIFI_STA_CONNECTED) {
+      g_wifi_associated = true;
+      Preferences preferences;
+      if (preferences.begin("wifi", false)) {
+        // Unchanged values are not written again, NVS compares them first.
+        preferences.putString("ssid", WIFI_SSID);
+        preferences.putBytes("bssid", info.wifi_sta_connected.bssid, sizeof(info.wifi_sta_connected.bssid));
+        preferences.putUChar("channel", info.wifi_sta_connected.channel);
+        preferences.end();
+      }
+    } else if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED && g_wifi_directed) {
+      // Reconnections scan, the access point may have moved to another channel.
+      g_wifi_directed = false;
+      if (!g_wifi_associated) {
+        printf("directed association failed, scanning\n");
+        Preferences preferences;
+        if (preferences.begin("wifi", false)) {
+          preferences.clear();
+          preferences.end();
+        }
+      }
+      WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+    }
+  });
+
+  uint8_t bssid[6] = {0};
+  uint8_t channel = 0;
+  Preferences preferences;
+  if (preferences.begin("wifi", true)) {
+    if (preferences.getString("ssid") == WIFI_SSID && preferences.getBytes("bssid", bssid, sizeof(bssid)) == sizeof(bssid)) {
+      channel = preferences.getUChar("channel", 0);
+    }
+    preferences.end();
+  }
+
+  if (channel != 0) {
+    printf("directed association, channel %u\n", channel);
+    g_wifi_directed = true;
+    WiFi.begin(WIFI_SSID, WIFI_PASSWORD, channel, bssid);
+  } else {
+    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  }
+}
 }  // namespace
 
 void setup() {
@@ -387,7 +440,7 @@ void setup() {
   g_display->ShowStatus("Wifi connecting...");
 
   WiFi.useStaticBuffers(true);
-  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  WifiBegin();
   while (WiFi.status() != WL_CONNECTED) {
     delay(1000);
     printf("Connecting to WiFi, ssid: %s, password: %s\n", WIFI_SSID, WIFI_PASSWORD);
@@ -173,28 +173,9 @@ void PrintMemInfo() {
 #endif
 
 void WifiConnect() {
-  auto& wifi = Wifi::GetInstance();
-
+  // Not waited for: the engine loads the audio devices meanwhile and waits for the address itself.
   printf("Connecting to WiFi, ssid: %s, password: %s\n", WIFI_SSID, WIFI_PASSWORD);
-  wifi.Connect(WIFI_SSID, WIFI_PASSWORD);
-
-  uint32_t attempt_count = 0;
-  while (!wifi.IsConnected()) {
-    printf("Connecting to WiFi (attempt %" PRIu32 ")... ssid: %s\n", attempt_count++, WIFI_SSID);
-    delay(800);
-  }
-
-  printf("Wifi Connected. Getting IP...\n");
-  while (!wifi.IsGotIp()) {
-    delay(10);
-  }
-  printf("Got wifi info\n");
-
-  const auto ip_info = wifi.ip_info();
-  printf("IP Info:\n");
-  printf("- ip: " IPSTR "\n", IP2STR(&ip_info.ip));
-  printf("- mask: " IPSTR "\n", IP2STR(&ip_info.netmask));
-  printf("- gw: " IPSTR "\n", IP2STR(&ip_info.gw));
+  Wifi::GetInstance().Connect(WIFI_SSID, WIFI_PASSWORD);
 }
 }  // namespace
 
@@ -273,6 +254,15 @@ void loop() {
           break;
         }
       }
+    } else if (auto boot_timeline_event = std::get_if<ai_vox::Observer::BootTimelineEvent>(&event)) {
+      for (const auto& stage : boot_timeline_event->stages) {
+        printf("boot stage %s: %lld -> %lld ms%s\n",
+               stage.name.c_str(),
+               stage.start_us / 1000,
+               stage.end_us / 1000,
+               stage.ok ? "" : ", failed");
+      }
+      printf("standby at %lld ms\n", boot_timeline_event->standby_us / 1000);
     } else if (auto emotion_event = std::get_if<ai_vox::Observer::EmotionEvent>(&event)) {
       printf("emotion: %s\n", emotion_event->emotion.c_str());
     } else if (auto chat_message_event = std::get_if<ai_vox::Observer::ChatMessageEvent>(&event)) {
@@ -1,9 +1,13 @@
 #include "wifi.h"
 
+#include <esp_timer.h>
 #include <esp_wifi.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <nvs.h>
+#include <ping/ping_sock.h>
 
+#include <cinttypes>
 #include <cstring>
 
 namespace {
@@ -12,6 +16,69 @@ enum Status : EventBits_t {
   kWifiConnected = 1 << 1,
   kGotIp = 1 << 2,
 };
+
+constexpr char kNvsNamespace[] = "wifi";
+
+struct AccessPoint {
+  uint8_t bssid[6];
+  uint8_t channel;
+};
+
+struct Lease {
+  esp_netif_ip_info_t ip_info;
+  esp_ip4_addr_t dns;
+};
+
+// Values cached for |ssid| only, another network starts with a scan and DHCP.
+template <typename T>
+bool LoadCached(const std::string& ssid, const char* key, T& value) {
+  nvs_handle_t handle = 0;
+  if (nvs_open(kNvsNamespace, NVS_READONLY, &handle) != ESP_OK) {
+    return false;
+  }
+
+  char cached_ssid[33] = {0};
+  size_t ssid_size = sizeof(cached_ssid);
+  size_t size = sizeof(value);
+  const auto found = nvs_get_str(handle, "ssid", cached_ssid, &ssid_size) == ESP_OK && ssid == cached_ssid &&
+                     nvs_get_blob(handle, key, &value, &size) == ESP_OK && size == sizeof(value);
+  nvs_close(handle);
+  return found;
+}
+
+// Unchanged values are not written again, NVS compares them first.
+template <typename T>
+void SaveCached(const std::string& ssid, const char* key, const T& value) {
+  nvs_handle_t handle = 0;
+  if (nvs_open(kNvsNamespace, NVS_READWRITE, &handle) != ESP_OK) {
+    return;
+  }
+
+  char cached_ssid[33] = {0};
+  size_t ssid_size = sizeof(cached_ssid);
+  if (nvs_get_str(handle, "ssid", cached_ssid, &ssid_size) != ESP_OK || ssid != cached_ssid) {
+    // What was cached belongs to another network.
+    nvs_erase_all(handle);
+    nvs_set_str(handle, "ssid", ssid.c_str());
+  }
+  nvs_set_blob(handle, key, &value, sizeof(value));
+  nvs_commit(handle);
+  nvs_close(handle);
+}
+
+void EraseCached(const char* key) {
+  nvs_handle_t handle = 0;
+  if (nvs_open(kNvsNamespace, NVS_READWRITE, &handle) != ESP_OK) {
+    return;
+  }
+  nvs_erase_key(handle, key);
+  nvs_commit(handle);
+  nvs_close(handle);
+}
+
+uint32_t ElapsedMs(const int64_t from, const int64_t to) {
+  return from == 0 || to == 0 ? 0 : static_cast<uint32_t>((to - from) / 1000);
+}
 }  // namespace
 
 Wifi& Wifi::GetInstance() {
@@ -27,7 +94,7 @@ Wifi::Wifi() : event_group_(xEventGroupCreate()) {
   esp_event_loop_create_default();
   ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &WifiEventHandler, this));
   ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, ESP_EVENT_ANY_ID, &IpEventHandler, this));
-  esp_netif_create_default_wifi_sta();
+  netif_ = esp_netif_create_default_wifi_sta();
   wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
 
   cfg.static_tx_buf_num = 0;
@@ -63,15 +130,43 @@ void Wifi::WifiEventHandler(esp_event_base_t event_base, int32_t event_id, void*
     }
     case WIFI_EVENT_STA_DISCONNECTED: {
       printf("WIFI_EVENT_STA_DISCONNECTED\n");
+      const auto was_connected = IsConnected();
       memset(&ip_info_, sizeof(ip_info_), 0);
       xEventGroupClearBits(event_group_, kGotIp);
       xEventGroupClearBits(event_group_, kWifiConnected);
+      {
+        // The times of the reconnection.
+        std::lock_guard<std::mutex> lock(mutex_);
+        connect_time_ = esp_timer_get_time();
+        associated_time_ = 0;
+        got_ip_time_ = 0;
+      }
+      if (directed_) {
+        if (!was_connected) {
+          // The access point moved to another channel or is gone.
+          printf("directed association failed, scanning\n");
+          EraseCached("ap");
+        }
+        ScanOnNextConnect();
+      }
       ESP_ERROR_CHECK(esp_wifi_disconnect());
       ESP_ERROR_CHECK(esp_wifi_connect());
       break;
     }
     case WIFI_EVENT_STA_CONNECTED: {
-      printf("WIFI_EVENT_STA_CONNECTED\n");
+      const auto* connected = reinterpret_cast<wifi_event_sta_connected_t*>(event_data);
+      AccessPoint access_point;
+      memcpy(access_point.bssid, connected->bssid, sizeof(access_point.bssid));
+      access_point.channel = connected->channel;
+      SaveCached(ssid_, "ap", access_point);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        associated_time_ = esp_timer_get_time();
+      }
+      printf("WIFI_EVENT_STA_CONNECTED, channel %u, %s, %" PRIu32 " ms\n",
+             connected->channel,
+             directed_ ? "directed" : "scanned",
+             association_time_ms());
       xEventGroupSetBits(event_group_, kWifiConnected);
       break;
     }
@@ -84,10 +179,21 @@ void Wifi::WifiEventHandler(esp_event_base_t event_base, int32_t event_id, void*
 void Wifi::IpEventHandler(esp_event_base_t event_base, int32_t event_id, void* event_data) {
   switch (event_id) {
     case IP_EVENT_STA_GOT_IP: {
-      printf("IP_EVENT_STA_GOT_IP\n");
       {
         std::lock_guard<std::mutex> lock(mutex_);
         ip_info_ = reinterpret_cast<ip_event_got_ip_t*>(event_data)->ip_info;
+        got_ip_time_ = esp_timer_get_time();
+      }
+      printf("IP_EVENT_STA_GOT_IP, %s, %" PRIu32 " ms\n", dhcp_ ? "dhcp" : "static", dhcp_time_ms());
+      if (lease_reused_) {
+        VerifyLease();
+      }
+      if (dhcp_ && reuse_lease_) {
+        Lease lease;
+        lease.ip_info = ip_info();
+        esp_netif_dns_info_t dns;
+        lease.dns.addr = esp_netif_get_dns_info(netif_, ESP_NETIF_DNS_MAIN, &dns) == ESP_OK ? dns.ip.u_addr.ip4.addr : 0;
+        SaveCached(ssid_, "lease", lease);
       }
       xEventGroupSetBits(event_group_, kGotIp);
       break;
@@ -98,12 +204,28 @@ void Wifi::IpEventHandler(esp_event_base_t event_base, int32_t event_id, void* e
   }
 }
 
+void Wifi::SetStaticIp(const esp_netif_ip_info_t& ip_info, const esp_ip4_addr_t& dns) {
+  static_ip_ = true;
+  static_ip_info_ = ip_info;
+  static_dns_ = dns;
+}
+
+void Wifi::SetReuseLease(const bool enable) {
+  reuse_lease_ = enable;
+}
+
 void Wifi::Connect(const std::string& ssid, const std::string& password) {
   if (0 != (xEventGroupGetBits(event_group_) && kStationStarted)) {
     printf("wifi sta already started\n");
     return;
   }
 
+  ssid_ = ssid;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    connect_time_ = esp_timer_get_time();
+  }
+
   wifi_config_t wifi_config;
   memset(&wifi_config, 0, sizeof(wifi_config));
   wifi_config.sta.scan_method = WIFI_FAST_SCAN;
@@ -117,6 +239,25 @@ void Wifi::Connect(const std::string& ssid, const std::string& password) {
     strncpy(reinterpret_cast<char*>(wifi_config.sta.password), password.c_str(), sizeof(wifi_config.sta.password) - 1);
   }
 
+  // Probes the one channel of the cached access point, a full scan takes seconds.
+  AccessPoint access_point;
+  if (LoadCached(ssid, "ap", access_point)) {
+    printf("directed association, channel %u\n", access_point.channel);
+    directed_ = true;
+    wifi_config.sta.bssid_set = true;
+    memcpy(wifi_config.sta.bssid, access_point.bssid, sizeof(wifi_config.sta.bssid));
+    wifi_config.sta.channel = access_point.channel;
+  }
+
+  Lease lease;
+  if (static_ip_) {
+    UseIp(static_ip_info_, static_dns_);
+  } else if (reuse_lease_ && LoadCached(ssid, "lease", lease)) {
+    printf("reusing lease " IPSTR "\n", IP2STR(&lease.ip_info.ip));
+    UseIp(lease.ip_info, lease.dns);
+    lease_reused_ = true;
+  }
+
   ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
   ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
   ESP_ERROR_CHECK(esp_wifi_start());
@@ -124,10 +265,102 @@ void Wifi::Connect(const std::string& ssid, const std::string& password) {
   ESP_ERROR_CHECK(esp_wifi_connect());
 }
 
+void Wifi::ScanOnNextConnect() {
+  directed_ = false;
+  wifi_config_t wifi_config;
+  if (esp_wifi_get_config(WIFI_IF_STA, &wifi_config) != ESP_OK) {
+    return;
+  }
+  wifi_config.sta.bssid_set = false;
+  memset(wifi_config.sta.bssid, 0, sizeof(wifi_config.sta.bssid));
+  wifi_config.sta.channel = 0;
+  esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+}
+
+void Wifi::UseIp(const esp_netif_ip_info_t& ip_info, const esp_ip4_addr_t& dns) {
+  // With the DHCP client stopped, the address is set as soon as the station associates.
+  dhcp_ = false;
+  esp_netif_dhcpc_stop(netif_);
+  ESP_ERROR_CHECK(esp_netif_set_ip_info(netif_, &ip_info));
+  if (dns.addr != 0) {
+    esp_netif_dns_info_t dns_info;
+    memset(&dns_info, 0, sizeof(dns_info));
+    dns_info.ip.type = ESP_IPADDR_TYPE_V4;
+    dns_info.ip.u_addr.ip4 = dns;
+    esp_netif_set_dns_info(netif_, ESP_NETIF_DNS_MAIN, &dns_info);
+  }
+}
+
+void Wifi::VerifyLease() {
+  // The address may have been given to another device since, or the network renumbered: the gateway then does not answer.
+  const auto gateway = ip_info().gw;
+  if (gateway.addr == 0) {
+    RestartDhcp();
+    return;
+  }
+
+  esp_ping_config_t config = ESP_PING_DEFAULT_CONFIG();
+  ip_addr_set_ip4_u32(&config.target_addr, gateway.addr);
+  config.count = 3;
+  config.interval_ms = 200;
+  config.timeout_ms = 1000;
+
+  esp_ping_callbacks_t callbacks;
+  memset(&callbacks, 0, sizeof(callbacks));
+  callbacks.cb_args = this;
+  callbacks.on_ping_end = [](esp_ping_handle_t handle, void* arg) {
+    uint32_t replies = 0;
+    esp_ping_get_profile(handle, ESP_PING_PROF_REPLY, &replies, sizeof(replies));
+    esp_ping_delete_session(handle);
+    auto* self = reinterpret_cast<Wifi*>(arg);
+    self->lease_reused_ = false;
+    if (replies == 0) {
+      printf("no reply from the gateway on the reused lease, restarting dhcp\n");
+      self->RestartDhcp();
+    }
+  };
+
+  esp_ping_handle_t handle = nullptr;
+  if (esp_ping_new_session(&config, &callbacks, &handle) != ESP_OK || esp_ping_start(handle) != ESP_OK) {
+    // Not verifiable, DHCP is the safe choice.
+    if (handle != nullptr) {
+      esp_ping_delete_session(handle);
+    }
+    RestartDhcp();
+  }
+}
+
+void Wifi::RestartDhcp() {
+  lease_reused_ = false;
+  EraseCached("lease");
+  xEventGroupClearBits(event_group_, kGotIp);
+  esp_netif_ip_info_t none;
+  memset(&none, 0, sizeof(none));
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ip_info_ = none;
+    associated_time_ = esp_timer_get_time();
+    got_ip_time_ = 0;
+  }
+  esp_netif_set_ip_info(netif_, &none);
+  dhcp_ = true;
+  esp_netif_dhcpc_start(netif_);
+}
+
 bool Wifi::IsConnected() {
   return (xEventGroupGetBits(event_group_) & kWifiConnected) != 0;
 }
 
 bool Wifi::IsGotIp() {
   return (xEventGroupGetBits(event_group_) & kGotIp) != 0;
+}
+
+uint32_t Wifi::association_time_ms() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return ElapsedMs(connect_time_, associated_time_);
+}
+
+uint32_t Wifi::dhcp_time_ms() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return ElapsedMs(associated_time_, got_ip_time_);
 }
\ No newline at end of file
@@ -1,17 +1,25 @@
-
 #pragma once
 
 #ifndef _AI_VOX_WIFI_H_
 #define _AI_VOX_WIFI_H_
 
+#include <esp_netif.h>
 #include <esp_wifi.h>
 
+#include <cstdint>
 #include <mutex>
 #include <string>
 
+// The station. The access point it associated with last, BSSID and channel, is kept in NVS: the next Connect() associates with it
+// directly, without scanning every channel, and falls back to a scan when that fails.
 class Wifi {
  public:
   static Wifi& GetInstance();
+  // Uses |ip_info| and |dns| instead of DHCP. Before Connect().
+  void SetStaticIp(const esp_netif_ip_info_t& ip_info, const esp_ip4_addr_t& dns);
+  // Reuses the last DHCP lease, kept in NVS, instead of asking for one: only for networks whose DHCP server binds the address to
+  // the MAC address, as the lease is not renewed. A lease the gateway does not answer on is dropped for DHCP. Before Connect().
+  void SetReuseLease(const bool enable);
   void Connect(const std::string& ssid, const std::string& password);
   bool IsConnected();
   bool IsGotIp();
@@ -20,6 +28,11 @@ class Wifi {
     return ip_info_;
   }
 
+  // From Connect() to the association, 0 until associated.
+  uint32_t association_time_ms() const;
+  // From the association to the IP address, 0 until it is obtained.
+  uint32_t dhcp_time_ms() const;
+
  private:
   Wifi();
   Wifi(const Wifi&) = delete;
@@ -30,10 +43,26 @@ class Wifi {
 
   void WifiEventHandler(esp_event_base_t event_base, int32_t event_id, void* event_data);
   void IpEventHandler(esp_event_base_t event_base, int32_t event_id, void* event_data);
+  void ScanOnNextConnect();
+  void UseIp(const esp_netif_ip_info_t& ip_info, const esp_ip4_addr_t& dns);
+  void VerifyLease();
+  void RestartDhcp();
 
   mutable std::mutex mutex_;
   EventGroupHandle_t event_group_ = nullptr;
+  esp_netif_t* netif_ = nullptr;
   esp_netif_ip_info_t ip_info_;
+  std::string ssid_;
+  bool directed_ = false;  // associating with the cached access point
+  bool static_ip_ = false;
+  esp_netif_ip_info_t static_ip_info_;
+  esp_ip4_addr_t static_dns_;
+  bool reuse_lease_ = false;
+  bool lease_reused_ = false;  // addressed from the cached lease, not yet answered by the gateway
+  bool dhcp_ = true;
+  int64_t connect_time_ = 0;  // us, esp_timer
+  int64_t associated_time_ = 0;
+  int64_t got_ip_time_ = 0;
 };
 
 #endif
\ No newline at end of file
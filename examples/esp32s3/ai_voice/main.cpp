@@ -1,4 +1,5 @@
 #include <Arduino.h>
+#include <Preferences.h>
 #include <WiFi.h>
 
 #include "ai_vox_engine.h"
@@ -172,6 +173,58 @@ void PrintMemInfo() {
   }
 }
 #endif
+
+// Set before the first event, then touched by the Arduino event task only.
+bool g_wifi_directed = false;
+bool g_wifi_associated = false;
+
+// Associates directly with the access point of the last connection, BSSID and channel kept in NVS, instead of scanning every
+// channel; a failed attempt drops them and scans.
+void WifiBegin() {
+  WiFi.onEvent([](arduino_event_id_t event, arduino_event_info_t info) {
+    if (event == ARDUINO_EVENT_WIFI_STA_CONNECTED) {
+      g_wifi_associated = true;
+      Preferences preferences;
+      if (preferences.begin("wifi", false)) {
+        // Unchanged values are not written again, NVS compares them first.
+        preferences.putString("ssid", WIFI_SSID);
+        preferences.putBytes("bssid", info.wifi_sta_connected.bssid, sizeof(info.wifi_sta_connected.bssid));
+        preferences.putUChar("channel", info.wifi_sta_connected.channel);
+        preferences.end();
+      }
+    } else if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED && g_wifi_directed) {
+      // Reconnections scan, the access point may have moved to another channel.
+      g_wifi_directed = false;
+      if (!g_wifi_associated) {
+        printf("directed association failed, scanning\n");
+        Preferences preferences;
+        if (preferences.begin("wifi", false)) {
+          preferences.clear();
+          preferences.end();
+        }
+      }
+      WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+    }
+  });
+
+  uint8_t bssid[6] = {0};
+  uint8_t channel = 0;
+  Preferences preferences;
+  if (preferences.begin("wifi", true)) {
+    if (preferences.getString("ssid") == WIFI_SSID && preferences.getBytes("bssid", bssid, sizeof(bssid)) == sizeof(bssid)) {
+      channel = preferences.getUChar("channel", 0);
+    }
+    preferences.end();
+  }
+
+  if (channel != 0) {
+    printf("directed association, channel %u\n", channel);
+    g_wifi_directed = true;
+    WiFi.begin(WIFI_SSID, WIFI_PASSWORD, channel, bssid);
+  } else {
+    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  }
+}
 }  // namespace
 
 void setup() {
@@ -184,14 +237,9 @@ void setup() {
     WiFi.useStaticBuffers(false);
   }
 
+  // Not waited for: the engine loads the audio devices and the wake word model meanwhile and waits for the address itself.
   printf("Connecting to WiFi, ssid: %s, password: %s\n", WIFI_SSID, WIFI_PASSWORD);
-  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(1000);
-    printf("Connecting to WiFi, ssid: %s, password: %s\n", WIFI_SSID, WIFI_PASSWORD);
-  }
-
-  printf("WiFi connected, IP address: %s\n", WiFi.localIP().toString().c_str());
+  WifiBegin();
 
   pinMode(kLedPin, OUTPUT);
   digitalWrite(kLedPin, LOW);
@@ -261,6 +309,15 @@ void loop() {
           break;
         }
       }
+    } else if (auto boot_timeline_event = std::get_if<ai_vox::Observer::BootTimelineEvent>(&event)) {
+      for (const auto& stage : boot_timeline_event->stages) {
+        printf("boot stage %s: %lld -> %lld ms%s\n",
+               stage.name.c_str(),
+               stage.start_us / 1000,
+               stage.end_us / 1000,
+               stage.ok ? "" : ", failed");
+      }
+      printf("standby at %lld ms\n", boot_timeline_event->standby_us / 1000);
     } else if (auto emotion_event = std::get_if<ai_vox::Observer::EmotionEvent>(&event)) {
       printf("emotion: %s\n", emotion_event->emotion.c_str());
     } else if (auto chat_message_event = std::get_if<ai_vox::Observer::ChatMessageEvent>(&event)) {
@@ -27,6 +27,23 @@ class Engine {
   virtual void SetOtaUrl(const std::string url) = 0;
   virtual void ConfigWebsocket(const std::string url, const std::map<std::string, std::string> headers) = 0;
   virtual void RegisterIotEntity(std::shared_ptr<iot::Entity> entity) = 0;
+  // ms of audio before the wake word sent after it, 0 disables it. WakeNet only.
+  virtual void SetPreRollDuration(const uint32_t duration_ms) = 0;
+  // Skips silent frames; ends the turn after |end_of_speech_duration_ms| of silence, 0 leaves it to the server.
+  virtual void SetLocalVad(const bool enable, const uint32_t end_of_speech_duration_ms) = 0;
+  // Listens while the answer plays, with echo cancellation; |local_barge_in| also aborts it on speech. ESP32-S3 only.
+  virtual void SetFullDuplex(const bool enable, const bool local_barge_in) = 0;
+  // Bytes, larger messages are dropped. 16 KiB by default.
+  virtual void SetMaxWebsocketMessageSize(const size_t size) = 0;
+  // Opus packets per websocket message at most, when the server accepts it. 1, the default, disables aggregation.
+  virtual void SetAudioAggregation(const uint32_t max_packets) = 0;
+  // ms the session stays open after a conversation, 0, the default, closes it.
+  virtual void SetKeepWarm(const uint32_t idle_ttl_ms) = 0;
+  // Resumes TLS sessions; |persistent| keeps them in NVS. Needs CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS.
+  virtual void SetTlsSessionCache(const bool enable, const bool persistent) = 0;
+  // s the config is cached in NVS and used at boot, 0, the default, fetches it on every start.
+  virtual void SetConfigCacheTtl(const uint32_t ttl_sec) = 0;
+  // Returns at once; standby follows and the observer gets a BootTimelineEvent.
   virtual void Start(std::shared_ptr<AudioInputDevice> audio_input_device, std::shared_ptr<AudioOutputDevice> audio_output_device) = 0;
 
  private:
@@ -3,10 +3,12 @@
 #ifndef _AI_VOX_OBSERVER_H_
 #define _AI_VOX_OBSERVER_H_
 
+#include <cstdint>
 #include <deque>
 #include <mutex>
 #include <string>
 #include <variant>
+#include <vector>
 
 #include "iot_entity.h"
 
@@ -55,7 +57,20 @@ class Observer {
     std::map<std::string, iot::Value> parameters;
   };
 
-  using Event = std::variant<StateChangedEvent, ActivationEvent, ChatMessageEvent, EmotionEvent, IotMessageEvent>;
+  struct BootStage {
+    std::string name;
+    int64_t start_us;  // since power-on
+    int64_t end_us;
+    bool ok;
+  };
+
+  // Pushed once the start is over, stages in the order they ended.
+  struct BootTimelineEvent {
+    std::vector<BootStage> stages;
+    int64_t standby_us;  // since power-on, 0 when the engine did not reach standby
+  };
+
+  using Event = std::variant<StateChangedEvent, ActivationEvent, ChatMessageEvent, EmotionEvent, IotMessageEvent, BootTimelineEvent>;
 
   Observer() = default;
   virtual ~Observer() = default;
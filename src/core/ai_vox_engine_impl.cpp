@@ -3,17 +3,32 @@
 #include <cJSON.h>
 #include <esp_crt_bundle.h>
 #include <esp_mac.h>
+#include <esp_netif.h>
 #include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <freertos/task.h>
 
+#include <algorithm>
+#include <string_view>
+
 #include "ai_vox_observer.h"
+#include "audio_capture_service.h"
 #include "audio_input_engine.h"
 #include "audio_output_engine.h"
 #include "espressif_button/button_gpio.h"
 #include "espressif_button/iot_button.h"
+#include "config_cache.h"
 #include "fetch_config.h"
+#include "jitter_buffer.h"
+#include "opus_packet_aggregator.h"
+#include "opus_rate_controller.h"
+#include "opus_sample_rate/opus_sample_rate.h"
+#include "tls_session_cache.h"
+#include "tls_session_transport.h"
+#include "voice_activity_detector.h"
 #include "wake_net/wake_net.h"
+#include "websocket_message_assembler.h"
 
 #ifndef CLOGGER_SEVERITY
 #define CLOGGER_SEVERITY CLOGGER_SEVERITY_WARN
@@ -25,6 +40,67 @@ namespace ai_vox {
 
 namespace {
 
+// The pools hold what is in flight at steady state, bursts and larger buffers come from the heap, see LogPoolUsage().
+constexpr size_t kOpusSlabSize = 256;
+constexpr size_t kTextSlabSize = 256;
+// Besides the jitter buffer at its deepest target: the message being assembled, the packet being decoded and its FEC copy.
+constexpr size_t kDownlinkPacketsInFlight = 3;
+// Besides the aggregator: the frame being encoded, the one being sent and two queued.
+constexpr size_t kUplinkPacketsInFlight = 4;
+// A transcript, the start of an answer, its first sentence and emotion arrive together.
+constexpr size_t kTextMessagesInFlight = 5;
+constexpr uint32_t kCaptureChunkDuration = 20;  // ms
+constexpr auto kConnectTimeout = std::chrono::seconds(15);  // from starting the websocket client to the server hello
+constexpr auto kListenTimeout = std::chrono::seconds(30);   // listening without the server recognizing speech nor answering
+constexpr auto kStateTimeoutTolerance = std::chrono::seconds(1);
+constexpr char kLengthPrefixedFraming[] = "length_prefixed";
+constexpr int kKeepWarmPongTimeout = 30;  // s, a dead session is noticed and restored well before the user needs it
+constexpr auto kReconnectMinDelay = std::chrono::seconds(1);
+constexpr auto kReconnectMaxDelay = std::chrono::seconds(30);
+constexpr auto kConfigRefreshDelay = std::chrono::seconds(10);  // after a start from the cache, out of the way of the first turn
+constexpr auto kConfigRefreshMinPeriod = std::chrono::minutes(1);
+constexpr auto kConfigRefreshTolerance = std::chrono::seconds(30);
+constexpr auto kIpPollInterval = std::chrono::milliseconds(100);  // while the boot config waits for Wi-Fi
+constexpr int kPreconnectTimeoutMs = 10000;
+
+uint32_t AudioWorkerStackSize() {
+  // Fits the Opus encoder of AudioInputEngine, the deepest of the audio strands.
+  return heap_caps_get_total_size(MALLOC_CAP_SPIRAM) == 0 ? 20 << 10 : 32 << 10;
+}
+
+// The encoder and the playback only overlap in full duplex, on the ESP32-S3, which gets a second worker.
+#ifdef ARDUINO_ESP32S3_DEV
+constexpr size_t kAudioWorkers = 2;
+#else
+constexpr size_t kAudioWorkers = 1;
+#endif
+// One worker for the network strands, the sends are bounded so that none of them holds it for long.
+constexpr size_t kNetworkWorkers = 1;
+constexpr uint32_t kNetworkWorkerStackSize = 8 << 10;  // mbedTLS handshakes, the HTTPS config request, JSON printed and parsed
+constexpr int kSendTimeoutMs = 2000;       // text messages and the close
+constexpr int kAudioSendTimeoutMs = 1000;  // an uplink frame, later than that it is stale anyway
+
+size_t TransmitQueueCapacity() {
+  // Frames, unbounded with PSRAM.
+  return heap_caps_get_total_size(MALLOC_CAP_SPIRAM) == 0 ? 6 : 0;
+}
+
+size_t OpusPacketsInFlight(const uint32_t max_packets_per_message) {
+  return JitterBuffer::kMaxTargetDepth + kDownlinkPacketsInFlight + max_packets_per_message + kUplinkPacketsInFlight;
+}
+
+void LogPoolUsage(const char *name, const BufferPool &pool) {
+  if (pool.miss_count() > 0) {
+    CLOGW("%s pool: %" PRIu32 " allocations from the heap, lowest free %zu of %zu",
+          name,
+          pool.miss_count(),
+          pool.min_free_count(),
+          pool.slab_count());
+  } else {
+    CLOGI("%s pool: lowest free %zu of %zu", name, pool.min_free_count(), pool.slab_count());
+  }
+}
+
 enum WebScoketFrameType : uint8_t {
   kWebsocketTextFrame = 0x01,    // 文本帧
   kWebsocketBinaryFrame = 0x02,  // 二进制帧
@@ -88,6 +164,44 @@ void CJSONFree(void *obj) {
     cJSON_free(obj);
   }
 }
+
+// Whether a text message is {"type":"tts","state":"start"}, only parsed when it may be one.
+bool IsTtsStart(const FlexArray<uint8_t> &message) {
+  const std::string_view text(reinterpret_cast<const char *>(message.data()), message.size());
+  if (text.find("\"tts\"") == std::string_view::npos || text.find("\"start\"") == std::string_view::npos) {
+    return false;
+  }
+
+  std::unique_ptr<cJSON, decltype(&DeleteCjsonObj)> root_obj(cJSON_ParseWithLength(text.data(), text.size()), &DeleteCjsonObj);
+  const auto *type_json = cJSON_GetObjectItem(root_obj.get(), "type");
+  const auto *state_json = cJSON_GetObjectItem(root_obj.get(), "state");
+  return cJSON_IsString(type_json) && strcmp(type_json->valuestring, "tts") == 0 && cJSON_IsString(state_json) &&
+         strcmp(state_json->valuestring, "start") == 0;
+}
+
+bool StationHasIp() {
+  auto *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+  esp_netif_ip_info_t ip_info;
+  return netif != nullptr && esp_netif_get_ip_info(netif, &ip_info) == ESP_OK && ip_info.ip.addr != 0;
+}
+
+// Host and port of a wss:// URL.
+bool ParseWssUrl(const std::string &url, std::string &host, int &port) {
+  constexpr std::string_view kScheme = "wss://";
+  if (url.compare(0, kScheme.size(), kScheme) != 0) {
+    return false;
+  }
+
+  const auto authority_end = url.find('/', kScheme.size());
+  host = url.substr(kScheme.size(), authority_end == std::string::npos ? std::string::npos : authority_end - kScheme.size());
+  port = 443;
+  const auto colon = host.rfind(':');
+  if (colon != std::string::npos) {
+    port = atoi(host.c_str() + colon + 1);
+    host.resize(colon);
+  }
+  return !host.empty() && port > 0;
+}
 }  // namespace
 
 EngineImpl &EngineImpl::GetInstance() {
@@ -104,7 +218,10 @@ EngineImpl::EngineImpl()
       websocket_headers_{
           {"Authorization", "Bearer test-token"},
       },
-      task_queue_("AiVoxMain", 1024 * 4, tskIDLE_PRIORITY + 1) {
+      executor_(std::make_shared<Executor>(Executor::PoolConfig{kAudioWorkers, AudioWorkerStackSize(), tskIDLE_PRIORITY + 1},
+                                           Executor::PoolConfig{kNetworkWorkers, kNetworkWorkerStackSize, tskIDLE_PRIORITY + 1})),
+      task_queue_(executor_, Executor::Pool::kNetwork, tskIDLE_PRIORITY + 2),
+      background_(executor_, Executor::Pool::kNetwork, tskIDLE_PRIORITY + 1) {
   CLOGD();
 }
 
@@ -159,6 +276,79 @@ void EngineImpl::RegisterIotEntity(std::shared_ptr<iot::Entity> entity) {
   iot_manager_.RegisterEntity(std::move(entity));
 }
 
+void EngineImpl::SetPreRollDuration(const uint32_t duration_ms) {
+  std::lock_guard lock(mutex_);
+  if (state_ != State::kIdle) {
+    return;
+  }
+  pre_roll_duration_ = duration_ms;
+}
+
+void EngineImpl::SetLocalVad(const bool enable, const uint32_t end_of_speech_duration_ms) {
+  std::lock_guard lock(mutex_);
+  if (state_ != State::kIdle) {
+    return;
+  }
+  local_vad_ = enable;
+  end_of_speech_duration_ = end_of_speech_duration_ms;
+}
+
+void EngineImpl::SetMaxWebsocketMessageSize(const size_t size) {
+  std::lock_guard lock(mutex_);
+  if (state_ != State::kIdle) {
+    return;
+  }
+  max_websocket_message_size_ = size;
+}
+
+void EngineImpl::SetAudioAggregation(const uint32_t max_packets) {
+  std::lock_guard lock(mutex_);
+  if (state_ != State::kIdle) {
+    return;
+  }
+  max_packets_per_message_ = std::max<uint32_t>(max_packets, 1);
+}
+
+void EngineImpl::SetKeepWarm(const uint32_t idle_ttl_ms) {
+  std::lock_guard lock(mutex_);
+  if (state_ != State::kIdle) {
+    return;
+  }
+  keep_warm_ttl_ = idle_ttl_ms;
+}
+
+void EngineImpl::SetTlsSessionCache(const bool enable, const bool persistent) {
+  std::lock_guard lock(mutex_);
+  if (state_ != State::kIdle) {
+    return;
+  }
+  tls_session_cache_enabled_ = enable;
+  tls_session_cache_persistent_ = persistent;
+}
+
+void EngineImpl::SetConfigCacheTtl(const uint32_t ttl_sec) {
+  std::lock_guard lock(mutex_);
+  if (state_ != State::kIdle) {
+    return;
+  }
+  config_cache_ttl_ = ttl_sec;
+}
+
+void EngineImpl::SetFullDuplex(const bool enable, const bool local_barge_in) {
+  std::lock_guard lock(mutex_);
+  if (state_ != State::kIdle) {
+    return;
+  }
+#ifdef ARDUINO_ESP32S3_DEV
+  full_duplex_ = enable;
+  local_barge_in_ = local_barge_in;
+#else
+  if (enable) {
+    CLOGW("full duplex needs the ESP-SR audio front end, ignored");
+  }
+#endif
+}
+
 void EngineImpl::Start(std::shared_ptr<AudioInputDevice> audio_input_device, std::shared_ptr<AudioOutputDevice> audio_output_device) {
   CLOGD();
   std::lock_guard lock(mutex_);
@@ -166,11 +356,16 @@ void EngineImpl::Start(std::shared_ptr<AudioInputDevice> audio_input_device, std
     return;
   }
 
-  audio_input_device_ = std::move(audio_input_device);
   audio_output_device_ = std::move(audio_output_device);
-#ifdef ARDUINO_ESP32S3_DEV
-  wake_net_ = std::make_unique<WakeNet>([this]() { task_queue_.Enqueue([this]() { OnWakeUp(); }); }, audio_input_device_);
-#endif
+
+  // Every frame on the audio path borrows its buffer from these pools, so nothing is allocated per frame at steady state.
+  const auto max_sample_rate = std::max<uint32_t>({audio_output_device_->output_sample_rate(), 24000, 16000});
+  // A decoded frame, and its resampled copy when the device rate is not one of Opus.
+  const size_t pcm_frames = IsOpusSampleRate(audio_output_device_->output_sample_rate()) ? 1 : 2;
+  pcm_pool_ = std::make_shared<BufferPool>(max_sample_rate / 1000 * audio_frame_duration_ * sizeof(int16_t), pcm_frames);
+  opus_pool_ = std::make_shared<BufferPool>(kOpusSlabSize, OpusPacketsInFlight(max_packets_per_message_));
+  text_pool_ = std::make_shared<BufferPool>(kTextSlabSize, kTextMessagesInFlight);
+  opus_rate_controller_ = std::make_shared<OpusRateController>(OpusRateController::MaxLevel());
 
   button_config_t btn_cfg = {
       .long_press_time = 1000,
@@ -187,14 +382,31 @@ void EngineImpl::Start(std::shared_ptr<AudioInputDevice> audio_input_device, std
   ESP_ERROR_CHECK(iot_button_new_gpio_device(&btn_cfg, &gpio_cfg, &button_handle_));
   ESP_ERROR_CHECK(iot_button_register_cb(button_handle_, BUTTON_SINGLE_CLICK, nullptr, OnButtonClick, this));
 
-  ChangeState(State::kInited);
-  LoadProtocol();
+  message_assembler_ = std::make_unique<WebsocketMessageAssembler>(
+      max_websocket_message_size_,
+      text_pool_.get(),
+      opus_pool_.get(),
+      [this](const uint8_t op_code, FlexArray<uint8_t> &&message) { OnWebsocketMessage(op_code, std::move(message)); },
+      [this](const uint8_t op_code) { OnWebsocketMessageDropped(op_code); });
 
   esp_websocket_client_config_t websocket_cfg;
   memset(&websocket_cfg, 0, sizeof(websocket_cfg));
   websocket_cfg.uri = websocket_url_.c_str();
   websocket_cfg.task_prio = tskIDLE_PRIORITY;
   websocket_cfg.crt_bundle_attach = esp_crt_bundle_attach;
+  // Every audio frame goes through these buffers, kept in internal RAM for the TLS layer.
+  websocket_cfg.persistent_buffers = true;
+  if (tls_session_cache_enabled_) {
+    tls_session_cache_ = std::make_unique<TlsSessionCache>(tls_session_cache_persistent_);
+    websocket_cfg.tls_transport_init = [](void *cache) {
+      return TlsSessionTransport::Create(reinterpret_cast<TlsSessionCache *>(cache), esp_crt_bundle_attach);
+    };
+    websocket_cfg.tls_transport_arg = tls_session_cache_.get();
+  }
+  if (keep_warm_ttl_ > 0) {
+    // Pinged every 10 s by default, an idle session that stops answering is dropped, then restored, sooner than after 2 min.
+    websocket_cfg.pingpong_timeout_sec = kKeepWarmPongTimeout;
+  }
 
   CLOGI("url: %s", websocket_cfg.uri);
   web_socket_client_ = esp_websocket_client_init(&websocket_cfg);
@@ -209,6 +421,115 @@ void EngineImpl::Start(std::shared_ptr<AudioInputDevice> audio_input_device, std
   esp_websocket_client_append_header(web_socket_client_, "Device-Id", GetMacAddress().c_str());
   esp_websocket_client_append_header(web_socket_client_, "Client-Id", uuid_.c_str());
   esp_websocket_register_events(web_socket_client_, WEBSOCKET_EVENT_ANY, &EngineImpl::OnWebsocketEvent, this);
+
+  ChangeState(State::kLoadingProtocol);
+  StartBoot(std::move(audio_input_device));
+}
+
+void EngineImpl::StartBoot(std::shared_ptr<AudioInputDevice> &&audio_input_device) {
+  // The audio and the network chains run side by side, standby follows once both are done.
+  boot_chains_ = 2;
+  boot_strand_ = std::make_unique<Strand>(executor_, Executor::Pool::kAudio, tskIDLE_PRIORITY + 1);
+  boot_strand_->Enqueue([this, audio_input_device = std::move(audio_input_device)]() mutable {
+    InitAudio(std::move(audio_input_device));
+    task_queue_.Enqueue([this]() { OnBootChainDone(); });
+  });
+
+  config_loading_ = true;
+  const auto start_time = esp_timer_get_time();
+  background_.Enqueue([this, start_time]() { LoadBootConfig(start_time); });
+}
+
+void EngineImpl::LoadBootConfig(const int64_t wifi_start_time) {
+  // Polled, waiting would hold the network worker from the main strand.
+  if (!StationHasIp()) {
+    background_.EnqueueAt(std::chrono::steady_clock::now() + kIpPollInterval, [this, wifi_start_time]() { LoadBootConfig(wifi_start_time); });
+    return;
+  }
+  boot_timeline_.Add("wifi", wifi_start_time);
+
+  const auto start_time = esp_timer_get_time();
+  auto loaded = LoadConfig();
+  boot_timeline_.Add(loaded.cached ? "config_cache" : "config", start_time, loaded.config.has_value());
+  // Boxed, the config does not fit in a task.
+  task_queue_.Enqueue([this, loaded = std::make_unique<LoadedConfig>(std::move(loaded))]() mutable {
+    boot_config_ = std::move(*loaded);
+    OnBootChainDone();
+  });
+}
+
+void EngineImpl::InitAudio(std::shared_ptr<AudioInputDevice> &&audio_input_device) {
+  auto start_time = esp_timer_get_time();
+  // The microphone stays open from here on, wake word detection and the uplink encoder subscribe to the same captured chunks.
+#ifdef ARDUINO_ESP32S3_DEV
+  audio_capture_service_ = std::make_shared<AudioCaptureService>(std::move(audio_input_device), kCaptureChunkDuration, false, full_duplex_);
+#else
+  // Nothing but the Opus encoder consumes the captured audio, so it can skip the resampler.
+  audio_capture_service_ = std::make_shared<AudioCaptureService>(std::move(audio_input_device), kCaptureChunkDuration, true, false);
+#endif
+  audio_output_engine_ = std::make_shared<AudioOutputEngine>(
+      executor_, audio_output_device_, audio_frame_duration_, pcm_pool_, opus_pool_, full_duplex_ ? audio_capture_service_ : nullptr);
+  boot_timeline_.Add("codec", start_time);
+
+#ifdef ARDUINO_ESP32S3_DEV
+  start_time = esp_timer_get_time();
+  wake_net_ = std::make_shared<WakeNet>(executor_,
+                                        [this]() { task_queue_.Enqueue([this]() { OnWakeUp(); }); },
+                                        audio_capture_service_,
+                                        pre_roll_duration_,
+                                        full_duplex_,
+                                        [this]() { task_queue_.Enqueue([this]() { OnSpeechDetected(); }); });
+  boot_timeline_.Add("wake_net", start_time);
+#endif
+  // Both engines live as long as the engine and are paused between turns, a turn only resets the Opus state.
+  CreateAudioInputEngine();
+}
+
+void EngineImpl::OnBootChainDone() {
+  if (--boot_chains_ > 0) {
+    return;
+  }
+
+  // Its strand has nothing left to run.
+  boot_strand_.reset();
+  config_loading_ = false;
+  OnConfigLoaded(std::move(boot_config_));
+  boot_standby_time_ = state_ == State::kStandby ? esp_timer_get_time() : 0;
+  if (state_ == State::kStandby && tls_session_cache_) {
+    // After standby: fills the session cache for the first connection.
+    background_.Enqueue([this]() {
+      const auto start_time = esp_timer_get_time();
+      const auto ok = PreconnectTls();
+      boot_timeline_.Add("tls_preconnect", start_time, ok);
+      task_queue_.Enqueue([this]() { FinishBoot(); });
+    });
+    return;
+  }
+  FinishBoot();
+}
+
+void EngineImpl::FinishBoot() {
+  if (observer_) {
+    observer_->PushEvent(Observer::BootTimelineEvent{boot_timeline_.stages(), boot_standby_time_});
+  }
+}
+
+bool EngineImpl::PreconnectTls() {
+  std::string host;
+  int port = 0;
+  if (!ParseWssUrl(websocket_url_, host, port)) {
+    return false;
+  }
+
+  // The transport of the websocket client, connected and closed: the handshake leaves the session in the cache.
+  auto transport = TlsSessionTransport::Create(tls_session_cache_.get(), esp_crt_bundle_attach);
+  if (transport == nullptr) {
+    return false;
+  }
+  const auto ok = esp_transport_connect(transport, host.c_str(), port, kPreconnectTimeoutMs) == 0;
+  esp_transport_close(transport);
+  esp_transport_destroy(transport);
+  return ok;
 }
 
 void EngineImpl::OnButtonClick(void *button_handle, void *self) {
@@ -237,31 +558,12 @@ void EngineImpl::OnWebsocketEvent(esp_event_base_t base, int32_t event_id, void
     }
     case WEBSOCKET_EVENT_DISCONNECTED: {
       CLOGI("WEBSOCKET_EVENT_DISCONNECTED");
+      message_assembler_->Reset();
       task_queue_.Enqueue([this]() { OnWebSocketDisconnected(); });
       break;
     }
     case WEBSOCKET_EVENT_DATA: {
-      if (!data->fin) {
-        abort();
-      }
-
-      switch (data->op_code) {
-        case kWebsocketTextFrame: {
-          FlexArray<uint8_t> frame(data->data_len);
-          memcpy(frame.data(), data->data_ptr, data->data_len);
-          task_queue_.Enqueue([this, frame = std::move(frame)]() mutable { OnJsonData(std::move(frame)); });
-          break;
-        }
-        case kWebsocketBinaryFrame: {
-          FlexArray<uint8_t> frame(data->data_len);
-          memcpy(frame.data(), data->data_ptr, data->data_len);
-          task_queue_.Enqueue([this, frame = std::move(frame)]() mutable { OnAudioFrame(std::move(frame)); });
-          break;
-        }
-        default: {
-          break;
-        }
-      }
+      message_assembler_->OnData(*data);
       break;
     }
     case WEBSOCKET_EVENT_ERROR: {
@@ -279,9 +581,44 @@ void EngineImpl::OnWebsocketEvent(esp_event_base_t base, int32_t event_id, void
   }
 }
 
-void EngineImpl::OnAudioFrame(FlexArray<uint8_t> &&data) {
-  if (audio_output_engine_) {
-    audio_output_engine_->Write(std::move(data));
+void EngineImpl::OnWebsocketMessage(const uint8_t op_code, FlexArray<uint8_t> &&message) {
+  switch (op_code) {
+    case kWebsocketTextFrame: {
+      // The answer is accepted here, ahead of the audio that follows it, and only plays once the task queue handles it.
+      if (IsTtsStart(message)) {
+        audio_output_engine_->Open();
+      }
+      task_queue_.Enqueue([this, message = std::move(message)]() mutable { OnJsonData(std::move(message)); });
+      break;
+    }
+    case kWebsocketBinaryFrame: {
+      // The data plane: audio goes from the websocket task straight to the jitter buffer, whatever the task queue is busy with.
+      if (!length_prefixed_audio_) {
+        audio_output_engine_->Write(std::move(message));
+        break;
+      }
+
+      const auto valid = OpusPacketAggregator::Unpack(message.data(), message.size(), [this](const uint8_t *packet, const size_t size) {
+        FlexArray<uint8_t> data(opus_pool_.get(), size);
+        memcpy(data.data(), packet, size);
+        audio_output_engine_->Write(std::move(data));
+      });
+      if (!valid) {
+        CLOGW("malformed audio message of %zu bytes", message.size());
+        audio_output_engine_->NotifyDataLost();
+      }
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+}
+
+void EngineImpl::OnWebsocketMessageDropped(const uint8_t op_code) {
+  if (op_code == kWebsocketBinaryFrame) {
+    // Recovered from the FEC of the next packet when there is one.
+    audio_output_engine_->NotifyDataLost();
   }
 }
 
@@ -306,7 +643,7 @@ void EngineImpl::OnJsonData(FlexArray<uint8_t> &&data) {
 
   if (type == "hello") {
     const auto state = state_;
-    if (state_ != State::kWebsocketConnected && state_ != State::kWebsocketConnectedWithWakeup) {
+    if (state_ != State::kWebsocketConnected && state_ != State::kWebsocketConnectedWithWakeup && state_ != State::kStandbyConnecting) {
       CLOGE("Invalid state: %u", state_);
       return;
     }
@@ -317,19 +654,24 @@ void EngineImpl::OnJsonData(FlexArray<uint8_t> &&data) {
       CLOGI("Session ID: %s", session_id_.c_str());
     }
 
+    if (uplink_aggregator_) {
+      auto *framing_json = cJSON_GetObjectItem(cJSON_GetObjectItem(root_obj.get(), "audio_params"), "framing");
+      length_prefixed_audio_ = cJSON_IsString(framing_json) && strcmp(framing_json->valuestring, kLengthPrefixedFraming) == 0;
+      CLOGI("audio framing: %s", length_prefixed_audio_ ? kLengthPrefixedFraming : "none");
+    }
+
     SendIotDescriptions();
     SendIotUpdatedStates(true);
-    StartListening();
+    if (state == State::kStandbyConnecting) {
+      CLOGI("session restored in the background");
+      reconnect_attempts_ = 0;
+      ChangeState(State::kStandbyConnected);
+      return;
+    }
 
+    StartListening(state == State::kWebsocketConnectedWithWakeup);
     if (state == State::kWebsocketConnectedWithWakeup) {
-      std::unique_ptr<cJSON, decltype(&DeleteCjsonObj)> message_obj(cJSON_CreateObject(), &DeleteCjsonObj);
-      cJSON_AddStringToObject(message_obj.get(), "session_id", session_id_.c_str());
-      cJSON_AddStringToObject(message_obj.get(), "type", "listen");
-      cJSON_AddStringToObject(message_obj.get(), "state", "detect");
-      cJSON_AddStringToObject(message_obj.get(), "text", "你好小智");
-      auto json_str = cJSON_PrintUnformatted(message_obj.get());
-      CLOGI("Sending JSON: %s", json_str);
-      esp_websocket_client_send_text(web_socket_client_, json_str, strlen(json_str), pdMS_TO_TICKS(5000));
+      SendWakeWordDetected();
     }
   } else if (type == "goodbye") {
     auto session_id_json = cJSON_GetObjectItem(root_obj.get(), "session_id");
@@ -347,22 +689,31 @@ void EngineImpl::OnJsonData(FlexArray<uint8_t> &&data) {
 
         if (state_ == State::kSpeaking) {
           CLOGI("already speaking");
+          // A new answer after a barge-in the server handled without tts stop.
+          audio_output_engine_->Resume();
           return;
         } else if (state_ != State::kListening) {
           CLOGW("invalid state: %u", state_);
+          // Not played, the answer is dropped as it arrives.
+          audio_output_engine_->Flush();
           return;
         }
 
-        audio_input_engine_.reset();
-        transmit_queue_.reset();
+        if (full_duplex_) {
+          // Restart the uplink rather than stop it, so that a turn already ended by the local VAD streams again for barge-in.
+          audio_input_engine_->Resume();
+        } else {
+          PauseUplink();
 #ifdef ARDUINO_ESP32S3_DEV
-        wake_net_->Start();
+          wake_net_->Start();
 #endif
-        audio_output_engine_ = std::make_shared<AudioOutputEngine>(audio_output_device_, audio_frame_duration_);
+        }
+        // Held until now, in half duplex the answer only plays once the uplink is paused.
+        audio_output_engine_->Resume();
         ChangeState(State::kSpeaking);
       } else if (strcmp("stop", state_json->valuestring) == 0) {
         CLOG("tts stop");
-        if (audio_output_engine_) {
+        if (state_ == State::kSpeaking) {
           audio_output_engine_->NotifyDataEnd([this]() { task_queue_.Enqueue([this]() { OnAudioOutputDataConsumed(); }); });
         }
       } else if (strcmp("sentence_start", state_json->valuestring) == 0) {
@@ -378,6 +729,10 @@ void EngineImpl::OnJsonData(FlexArray<uint8_t> &&data) {
       }
     }
   } else if (type == "stt") {
+    if (state_ == State::kListening) {
+      // The server heard the user, the answer is on its way.
+      StartStateTimer(state_);
+    }
     auto text = cJSON_GetObjectItem(root_obj.get(), "text");
     if (text != nullptr) {
       CLOG(">> %s", text->valuestring);
@@ -433,6 +788,12 @@ void EngineImpl::OnJsonData(FlexArray<uint8_t> &&data) {
         }
       }
     }
+  } else if (type == "config") {
+    // Sent by the server when the config it gave changed, for example a new endpoint.
+    auto *action = cJSON_GetObjectItem(root_obj.get(), "action");
+    if (cJSON_IsString(action) && std::string(action->valuestring) == "invalidate") {
+      InvalidateConfig();
+    }
   } else {
     CLOGE("Unknown JSON type: %s", type.c_str());
   }
@@ -444,7 +805,7 @@ void EngineImpl::OnWebSocketConnected() {
     ChangeState(State::kWebsocketConnected);
   } else if (state_ == State::kWebsocketConnectingWithWakeup) {
     ChangeState(State::kWebsocketConnectedWithWakeup);
-  } else {
+  } else if (state_ != State::kStandbyConnecting) {
     CLOGE("invalid state: %u", state_);
     return;
   }
@@ -459,25 +820,102 @@ void EngineImpl::OnWebSocketConnected() {
   cJSON_AddNumberToObject(audio_params_obj, "sample_rate", 16000);
   cJSON_AddNumberToObject(audio_params_obj, "channels", 1);
   cJSON_AddNumberToObject(audio_params_obj, "frame_duration", audio_frame_duration_);
+  // Offered only, the audio stays one packet per message until the server hello takes it up.
+  length_prefixed_audio_ = false;
+  if (uplink_aggregator_) {
+    cJSON_AddStringToObject(audio_params_obj, "framing", kLengthPrefixedFraming);
+    cJSON_AddNumberToObject(audio_params_obj, "max_packets_per_message", max_packets_per_message_);
+  }
   cJSON_AddItemToObject(root_obj.get(), "audio_params", audio_params_obj);
 
   std::unique_ptr<char, decltype(&CJSONFree)> text(cJSON_PrintUnformatted(root_obj.get()), &CJSONFree);
   const auto length = strlen(text.get());
   CLOGI("sending text: %.*s", static_cast<int>(length), text.get());
-  esp_websocket_client_send_text(web_socket_client_, text.get(), length, pdMS_TO_TICKS(5000));
+  esp_websocket_client_send_text(web_socket_client_, text.get(), length, pdMS_TO_TICKS(kSendTimeoutMs));
+  hello_sent_ = true;
 }
 
 void EngineImpl::OnWebSocketDisconnected() {
-  CLOGI();
-  audio_input_engine_.reset();
-  transmit_queue_.reset();
-  audio_output_engine_.reset();
-  esp_websocket_client_close(web_socket_client_, pdMS_TO_TICKS(5000));
+  CLOGI("websocket buffers high water: %zu bytes", esp_websocket_client_get_buffer_high_water(web_socket_client_));
+  if (tls_session_cache_) {
+    CLOGI("tls session cache hits: %" PRIu32 ", misses: %" PRIu32, tls_session_cache_->hit_count(), tls_session_cache_->miss_count());
+  }
+  LogPoolUsage("pcm", *pcm_pool_);
+  LogPoolUsage("opus", *opus_pool_);
+  LogPoolUsage("text", *text_pool_);
+  const auto state = state_;
+  PauseUplink();
+  audio_output_engine_->Pause();
+  esp_websocket_client_close(web_socket_client_, pdMS_TO_TICKS(kSendTimeoutMs));
 
 #ifdef ARDUINO_ESP32S3_DEV
   wake_net_->Start();
 #endif
   ChangeState(State::kStandby);
+
+  // A disconnection is reported more than once, the first report in standby is already handled.
+  if (keep_warm_ttl_ == 0 || state == State::kStandby) {
+    return;
+  }
+
+  const auto now = std::chrono::steady_clock::now();
+  if (state == State::kListening || state == State::kSpeaking) {
+    // The conversation ended with the connection, the session is kept warm from now on as after any other conversation.
+    warm_deadline_ = now + std::chrono::milliseconds(keep_warm_ttl_);
+    reconnect_attempts_ = 0;
+  }
+
+  if (now >= warm_deadline_) {
+    return;
+  }
+
+  const auto delay = std::min<Strand::Duration>(kReconnectMinDelay * (1 << std::min<uint32_t>(reconnect_attempts_, 5)), kReconnectMaxDelay);
+  ++reconnect_attempts_;
+  CLOGI("reconnecting in %lld ms", std::chrono::duration_cast<std::chrono::milliseconds>(delay).count());
+  reconnect_timer_ = task_queue_.StartTimer(delay, Strand::Duration::zero(), kStateTimeoutTolerance, [this]() { ReconnectInBackground(); });
+}
+
+void EngineImpl::ReconnectInBackground() {
+  if (state_ != State::kStandby || std::chrono::steady_clock::now() >= warm_deadline_) {
+    return;
+  }
+
+  if (ConnectWebSocket()) {
+    ChangeState(State::kStandbyConnecting);
+  }
+}
+
+void EngineImpl::EnterWarmStandby() {
+  CLOGI();
+  PauseUplink();
+  // Audio of an answer the server still sends is not played in standby, the next tts start accepts audio again.
+  audio_output_engine_->Pause();
+  SendListenStop(session_id_);
+#ifdef ARDUINO_ESP32S3_DEV
+  wake_net_->Start();
+#endif
+  warm_deadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(keep_warm_ttl_);
+  reconnect_attempts_ = 0;
+  ChangeState(State::kStandbyConnected);
+}
+
+void EngineImpl::ResumeWarmSession(const bool wake_word_detected) {
+  CLOGI();
+  if (state_ == State::kStandbyConnecting) {
+    // Restored in the foreground from now on, the hello, sent or not yet, leads to listening.
+    if (hello_sent_) {
+      ChangeState(wake_word_detected ? State::kWebsocketConnectedWithWakeup : State::kWebsocketConnected);
+    } else {
+      ChangeState(wake_word_detected ? State::kWebsocketConnectingWithWakeup : State::kWebsocketConnecting);
+    }
+    return;
+  }
+
+  SendIotUpdatedStates(false);
+  StartListening(wake_word_detected);
+  if (wake_word_detected) {
+    SendWakeWordDetected();
+  }
 }
 
 void EngineImpl::OnAudioOutputDataConsumed() {
@@ -487,7 +925,7 @@ void EngineImpl::OnAudioOutputDataConsumed() {
     return;
   }
   SendIotUpdatedStates(false);
-  StartListening();
+  StartListening(false);
 }
 
 void EngineImpl::OnTriggered() {
@@ -503,8 +941,17 @@ void EngineImpl::OnTriggered() {
       }
       break;
     }
+    case State::kStandbyConnecting:
+    case State::kStandbyConnected: {
+      ResumeWarmSession(false);
+      break;
+    }
     case State::kListening: {
-      DisconnectWebSocket();
+      if (keep_warm_ttl_ > 0) {
+        EnterWarmStandby();
+      } else {
+        DisconnectWebSocket();
+      }
       break;
     }
     case State::kSpeaking: {
@@ -526,6 +973,11 @@ void EngineImpl::OnWakeUp() {
       }
       break;
     }
+    case State::kStandbyConnecting:
+    case State::kStandbyConnected: {
+      ResumeWarmSession(true);
+      break;
+    }
     case State::kSpeaking: {
       AbortSpeaking("wake_word_detected");
       break;
@@ -536,24 +988,78 @@ void EngineImpl::OnWakeUp() {
   }
 }
 
-void EngineImpl::LoadProtocol() {
+void EngineImpl::OnEndOfSpeech() {
   CLOGI();
-  if (state_ != State::kInited) {
-    CLOG("invalid state: %u", state_);
+  if (state_ != State::kListening) {
+    CLOGD("invalid state: %u", state_);
     return;
   }
 
-  ChangeState(State::kLoadingProtocol);
+  // On the transmit strand, after the frames of the utterance and the packets held by the aggregator.
+  transmit_queue_->EnqueueUnbounded([this, session_id = session_id_]() {
+    if (uplink_aggregator_) {
+      SendAggregatedAudio();
+    }
+    SendListenStop(session_id);
+  });
+}
+
+void EngineImpl::SendListenStop(const std::string &session_id) {
+  std::unique_ptr<cJSON, decltype(&DeleteCjsonObj)> root_obj(cJSON_CreateObject(), &DeleteCjsonObj);
+  cJSON_AddStringToObject(root_obj.get(), "session_id", session_id.c_str());
+  cJSON_AddStringToObject(root_obj.get(), "type", "listen");
+  cJSON_AddStringToObject(root_obj.get(), "state", "stop");
+  std::unique_ptr<char, decltype(&CJSONFree)> text(cJSON_PrintUnformatted(root_obj.get()), &CJSONFree);
+  const auto length = strlen(text.get());
+  CLOGI("sending text: %.*s", static_cast<int>(length), text.get());
+  esp_websocket_client_send_text(web_socket_client_, text.get(), length, pdMS_TO_TICKS(kSendTimeoutMs));
+}
 
-  auto config = GetConfigFromServer(ota_url_, uuid_);
+void EngineImpl::SendWakeWordDetected() {
+  std::unique_ptr<cJSON, decltype(&DeleteCjsonObj)> message_obj(cJSON_CreateObject(), &DeleteCjsonObj);
+  cJSON_AddStringToObject(message_obj.get(), "session_id", session_id_.c_str());
+  cJSON_AddStringToObject(message_obj.get(), "type", "listen");
+  cJSON_AddStringToObject(message_obj.get(), "state", "detect");
+  cJSON_AddStringToObject(message_obj.get(), "text", "你好小智");
+  auto json_str = cJSON_PrintUnformatted(message_obj.get());
+  CLOGI("Sending JSON: %s", json_str);
+  esp_websocket_client_send_text(web_socket_client_, json_str, strlen(json_str), pdMS_TO_TICKS(kSendTimeoutMs));
+}
 
+void EngineImpl::OnSpeechDetected() {
+  if (!local_barge_in_ || state_ != State::kSpeaking) {
+    return;
+  }
+
+  CLOGI("barge-in");
+  AbortSpeaking("speech_detected");
+}
+
+EngineImpl::LoadedConfig EngineImpl::LoadConfig() {
+  if (config_cache_ttl_ > 0) {
+    auto config = LoadCachedConfig(config_cache_ttl_);
+    if (config.has_value()) {
+      return {std::move(config), true};
+    }
+  }
+  return {GetConfigFromServer(ota_url_, uuid_), false};
+}
+
+void EngineImpl::OnConfigLoaded(LoadedConfig &&loaded) {
+  CLOGI();
+  if (state_ != State::kLoadingProtocol) {
+    CLOG("invalid state: %u", state_);
+    return;
+  }
+
+  auto &config = loaded.config;
   if (!config.has_value()) {
     CLOGE("GetConfigFromServer failed");
     ChangeState(State::kInited);
     return;
   }
 
-  CLOG("mqtt endpoint: %s", config->mqtt.endpoint.c_str());
+  CLOG("mqtt endpoint: %s%s", config->mqtt.endpoint.c_str(), loaded.cached ? " (cached)" : "");
   CLOG("mqtt client_id: %s", config->mqtt.client_id.c_str());
   CLOG("mqtt username: %s", config->mqtt.username.c_str());
   CLOG("mqtt password: %s", config->mqtt.password.c_str());
@@ -570,6 +1076,15 @@ void EngineImpl::LoadProtocol() {
     ChangeState(State::kInited);
     return;
   }
+  if (config_cache_ttl_ > 0) {
+    if (!loaded.cached) {
+      SaveCachedConfig(*config);
+    }
+    // Keeps the cache younger than its TTL, a start from the cache checks it first.
+    const auto period = std::max<std::chrono::seconds>(std::chrono::seconds(config_cache_ttl_ / 2), kConfigRefreshMinPeriod);
+    config_refresh_timer_ =
+        task_queue_.StartTimer(loaded.cached ? kConfigRefreshDelay : period, period, kConfigRefreshTolerance, [this]() { RefreshConfig(); });
+  }
 #ifdef ARDUINO_ESP32S3_DEV
   wake_net_->Start();
 #endif
@@ -577,8 +1092,81 @@ void EngineImpl::LoadProtocol() {
   return;
 }
 
-void EngineImpl::StartListening() {
-  if (state_ != State::kWebsocketConnected && state_ != State::kWebsocketConnectedWithWakeup && state_ != State::kSpeaking) {
+void EngineImpl::LoadProtocol() {
+  CLOGI();
+  if (state_ != State::kInited) {
+    CLOG("invalid state: %u", state_);
+    return;
+  }
+
+  if (config_loading_) {
+    CLOGW("config refresh pending");
+    return;
+  }
+
+  ChangeState(State::kLoadingProtocol);
+  config_loading_ = true;
+  background_.Enqueue([this]() {
+    task_queue_.Enqueue([this, loaded = std::make_unique<LoadedConfig>(LoadConfig())]() mutable {
+      config_loading_ = false;
+      OnConfigLoaded(std::move(*loaded));
+    });
+  });
+}
+
+void EngineImpl::RefreshConfig() {
+  if (config_loading_) {
+    CLOGD("config already loading");
+    return;
+  }
+
+  config_loading_ = true;
+  background_.Enqueue([this]() {
+    auto config = std::make_unique<std::optional<Config>>(GetConfigFromServer(ota_url_, uuid_));
+    task_queue_.Enqueue([this, config = std::move(config)]() mutable { OnConfigRefreshed(std::move(*config)); });
+  });
+}
+
+void EngineImpl::OnConfigRefreshed(std::optional<Config> &&config) {
+  config_loading_ = false;
+  if (!config.has_value()) {
+    CLOGW("config refresh failed, the cached config is kept");
+    return;
+  }
+
+  if (config->activation.code.empty()) {
+    SaveCachedConfig(*config);
+    return;
+  }
+
+  // The server wants the device activated again, the cache must not bring it back to standby.
+  config_refresh_timer_.Cancel();
+  EraseCachedConfig();
+  if (observer_) {
+    observer_->PushEvent(Observer::ActivationEvent{config->activation.code, config->activation.message});
+  }
+  // A turn in progress is not cut, the activation is asked for again at the next start.
+  if (state_ == State::kStandby) {
+#ifdef ARDUINO_ESP32S3_DEV
+    wake_net_->Stop();
+#endif
+    ChangeState(State::kInited);
+  }
+}
+
+void EngineImpl::InvalidateConfig() {
+  if (config_cache_ttl_ == 0) {
+    return;
+  }
+
+  CLOGI();
+  EraseCachedConfig();
+  RefreshConfig();
+}
+
+void EngineImpl::StartListening(const bool wake_word_detected) {
+  if (state_ != State::kWebsocketConnected && state_ != State::kWebsocketConnectedWithWakeup && state_ != State::kSpeaking &&
+      state_ != State::kStandbyConnected) {
     CLOG("invalid state: %u", state_);
     return;
   }
@@ -590,38 +1178,133 @@ void EngineImpl::StartListening() {
   cJSON_AddStringToObject(root_obj.get(), "mode", "auto");
   std::unique_ptr<char, decltype(&CJSONFree)> text(cJSON_PrintUnformatted(root_obj.get()), &CJSONFree);
   const auto length = strlen(text.get());
+  // Paused before the server is told, the audio of its next answer starts a new stream.
+  audio_output_engine_->Pause();
   CLOGI("sending text: %.*s", static_cast<int>(length), text.get());
-  esp_websocket_client_send_text(web_socket_client_, text.get(), length, pdMS_TO_TICKS(5000));
+  esp_websocket_client_send_text(web_socket_client_, text.get(), length, pdMS_TO_TICKS(kSendTimeoutMs));
+
+#ifdef ARDUINO_ESP32S3_DEV
+  if (!full_duplex_) {
+    wake_net_->Stop();
+  }
+  // Emptied either way, after a wake word it goes straight into the capture ring of the encoder, ahead of the live audio.
+  wake_net_->TakePreRoll([this, wake_word_detected](const int16_t *pcm, const size_t samples) {
+    if (wake_word_detected) {
+      audio_input_engine_->AppendPreRoll(pcm, samples);
+    }
+  });
+#endif
+  audio_input_engine_->Resume();
+  ChangeState(State::kListening);
+}
 
-  audio_output_engine_.reset();
+void EngineImpl::CreateAudioInputEngine() {
+  // The stalest frame goes first. Below the main strand, whose messages do not wait for an audio backlog.
+  transmit_queue_ = std::make_unique<Strand>(
+      executor_, Executor::Pool::kNetwork, tskIDLE_PRIORITY + 1, TransmitQueueCapacity(), Strand::OverflowPolicy::kDropOldest);
+  if (max_packets_per_message_ > 1) {
+    uplink_aggregator_ =
+        std::make_unique<OpusPacketAggregator>(max_packets_per_message_, kOpusSlabSize, audio_frame_duration_, ESP_WEBSOCKET_SEND_HEADROOM);
+  }
+
+  // In full duplex mode the uplink carries the echo-cancelled output of the audio front end instead of the raw microphone.
+  std::shared_ptr<AudioSource> audio_source = audio_capture_service_;
+  uint32_t pre_roll_duration = 0;
 #ifdef ARDUINO_ESP32S3_DEV
-  wake_net_->Stop();
+  if (full_duplex_) {
+    audio_source = wake_net_;
+  }
+  pre_roll_duration = pre_roll_duration_;
 #endif
-  transmit_queue_ = std::make_unique<TaskQueue>("AiVoxTransmit", 1024 * 3, tskIDLE_PRIORITY + 2);
   audio_input_engine_ = std::make_shared<AudioInputEngine>(
-      audio_input_device_,
+      executor_,
+      audio_source,
       [this](FlexArray<uint8_t> &&data) mutable {
-        if (heap_caps_get_total_size(MALLOC_CAP_SPIRAM) == 0 && transmit_queue_->Size() > 5) {
-          return;
+        const auto queue_depth = transmit_queue_->Size();
+        opus_rate_controller_->OnQueueDepth(queue_depth);
+        if (TransmitQueueCapacity() > 0 && queue_depth >= TransmitQueueCapacity()) {
+          opus_rate_controller_->OnFrameDropped();
         }
 
-        transmit_queue_->Enqueue([this, data = std::move(data)]() mutable {
-          if (esp_websocket_client_is_connected(web_socket_client_)) {
-            const auto start_time = esp_timer_get_time();
-            if (data.size() !=
-                esp_websocket_client_send_bin(web_socket_client_, reinterpret_cast<const char *>(data.data()), data.size(), pdMS_TO_TICKS(3000))) {
-              CLOGE("sending failed");
-            }
-
-            const auto elapsed_time = esp_timer_get_time() - start_time;
-            if (elapsed_time > 100 * 1000) {
-              CLOGW("Network latency high: %lld ms, data size: %zu bytes, poor network condition detected", elapsed_time / 1000, data.size());
-            }
-          }
-        });
+        // In the epoch of the stream, see PauseUplink().
+        transmit_queue_->EnqueueInEpoch(transmit_queue_->epoch(), [this, data = std::move(data)]() mutable { TransmitAudio(std::move(data)); });
       },
-      audio_frame_duration_);
-  ChangeState(State::kListening);
+      audio_frame_duration_,
+      opus_pool_,
+      opus_rate_controller_,
+      local_vad_ ? std::make_unique<VoiceActivityDetector>(audio_source->sample_rate(), audio_frame_duration_, end_of_speech_duration_) : nullptr,
+      [this]() { task_queue_.Enqueue([this]() { OnEndOfSpeech(); }); },
+      pre_roll_duration,
+      ESP_WEBSOCKET_SEND_HEADROOM);
+}
+
+void EngineImpl::TransmitAudio(FlexArray<uint8_t> &&data) {
+  if (!esp_websocket_client_is_connected(web_socket_client_)) {
+    return;
+  }
+
+  const auto size = data.size() - ESP_WEBSOCKET_SEND_HEADROOM;
+  if (!length_prefixed_audio_) {
+    // The frame is built in the headroom left by the encoder and the payload masked in place, no copy on the way out.
+    SendAudio(data.data(), size, 1);
+    return;
+  }
+
+  if (uplink_aggregator_->Append(data.data() + ESP_WEBSOCKET_SEND_HEADROOM, size)) {
+    SendAggregatedAudio();
+  } else if (uplink_aggregator_->packet_count() == 1) {
+    // Bounds the wait when the encoder stops producing, at the end of a turn or while the local VAD skips silence.
+    const auto hold = std::chrono::milliseconds(audio_frame_duration_ * uplink_aggregator_->packets_per_message());
+    aggregate_timer_ = transmit_queue_->StartTimer(
+        hold, Strand::Duration::zero(), std::chrono::milliseconds(audio_frame_duration_ / 2), [this]() { SendAggregatedAudio(); });
+  }
+}
+
+void EngineImpl::SendAggregatedAudio() {
+  aggregate_timer_.Cancel();
+  if (uplink_aggregator_->packet_count() == 0) {
+    return;
+  }
+
+  if (!esp_websocket_client_is_connected(web_socket_client_)) {
+    uplink_aggregator_->Clear();
+    return;
+  }
+
+  const auto send_time = SendAudio(uplink_aggregator_->data(), uplink_aggregator_->size(), uplink_aggregator_->packet_count());
+  uplink_aggregator_->OnSent(send_time, transmit_queue_->Size());
+}
+
+int64_t EngineImpl::SendAudio(uint8_t *buffer, const size_t size, const uint32_t packets) {
+  const auto start_time = esp_timer_get_time();
+  if (static_cast<int>(size) != esp_websocket_client_send_bin_in_place(web_socket_client_, buffer, size, pdMS_TO_TICKS(kAudioSendTimeoutMs))) {
+    CLOGE("sending failed");
+  }
+
+  const auto elapsed_time = esp_timer_get_time() - start_time;
+  // Per packet, the rate controller expects one send per frame.
+  opus_rate_controller_->OnSend(elapsed_time / packets);
+  if (elapsed_time > 100 * 1000 * packets) {
+    CLOGW("Network latency high: %lld ms, data size: %zu bytes, poor network condition detected", elapsed_time / 1000, size);
+  }
+  return elapsed_time;
+}
+
+void EngineImpl::PauseUplink() {
+  // The frame the encoder is busy with is discarded by the new epoch, once handed over.
+  audio_input_engine_->Pause([this]() { transmit_queue_->NewEpoch(); });
+  ClearTransmitQueue();
+}
+
+void EngineImpl::ClearTransmitQueue() {
+  transmit_queue_->Clear();
+  if (uplink_aggregator_) {
+    // Enqueued after the clear, the packets held back go with the queued ones.
+    transmit_queue_->Enqueue([this]() {
+      aggregate_timer_.Cancel();
+      uplink_aggregator_->Clear();
+    });
+  }
 }
 
 void EngineImpl::AbortSpeaking() {
@@ -636,7 +1319,8 @@ void EngineImpl::AbortSpeaking() {
   std::unique_ptr<char, decltype(&CJSONFree)> text(cJSON_PrintUnformatted(root_obj.get()), &CJSONFree);
   const auto length = strlen(text.get());
   CLOGI("sending text: %.*s", static_cast<int>(length), text.get());
-  esp_websocket_client_send_text(web_socket_client_, text.get(), length, pdMS_TO_TICKS(5000));
+  esp_websocket_client_send_text(web_socket_client_, text.get(), length, pdMS_TO_TICKS(kSendTimeoutMs));
+  FlushPlayback();
   CLOG("OK");
 }
 
@@ -653,7 +1337,15 @@ void EngineImpl::AbortSpeaking(const std::string &reason) {
   std::unique_ptr<char, decltype(&CJSONFree)> text(cJSON_PrintUnformatted(root_obj.get()), &CJSONFree);
   const auto length = strlen(text.get());
   CLOGI("sending text: %.*s", static_cast<int>(length), text.get());
-  esp_websocket_client_send_text(web_socket_client_, text.get(), length, pdMS_TO_TICKS(5000));
+  esp_websocket_client_send_text(web_socket_client_, text.get(), length, pdMS_TO_TICKS(kSendTimeoutMs));
+  FlushPlayback();
+}
+
+void EngineImpl::FlushPlayback() {
+  // Audio the server sends until it handles the abort is ignored up to the next tts start.
+  if (audio_output_engine_) {
+    audio_output_engine_->Flush();
+  }
 }
 
 bool EngineImpl::ConnectWebSocket() {
@@ -663,26 +1355,26 @@ bool EngineImpl::ConnectWebSocket() {
   }
 
   CLOGI("esp_websocket_client_start");
+  hello_sent_ = false;
   const auto ret = esp_websocket_client_start(web_socket_client_);
   CLOGI("websocket client start: %d", ret);
   return ret == ESP_OK;
 }
 
 void EngineImpl::DisconnectWebSocket() {
-  audio_input_engine_.reset();
-  transmit_queue_.reset();
-  audio_output_engine_.reset();
+  PauseUplink();
+  audio_output_engine_->Pause();
 #ifdef ARDUINO_ESP32S3_DEV
   wake_net_->Start();
 #endif
-  esp_websocket_client_close(web_socket_client_, pdMS_TO_TICKS(5000));
+  esp_websocket_client_close(web_socket_client_, pdMS_TO_TICKS(kSendTimeoutMs));
 }
 
 void EngineImpl::SendIotDescriptions() {
   const auto descirptions = iot_manager_.DescriptionsJson();
   for (const auto &descirption : descirptions) {
     CLOGI("sending text: %.*s", static_cast<int>(descirption.size()), descirption.c_str());
-    const auto ret = esp_websocket_client_send_text(web_socket_client_, descirption.c_str(), descirption.size(), pdMS_TO_TICKS(5000));
+    const auto ret = esp_websocket_client_send_text(web_socket_client_, descirption.c_str(), descirption.size(), pdMS_TO_TICKS(kSendTimeoutMs));
     if (ret != descirption.size()) {
       CLOGE("sending failed");
     } else {
@@ -696,7 +1388,7 @@ void EngineImpl::SendIotUpdatedStates(const bool force) {
   const auto updated_states = iot_manager_.UpdatedJson(force);
   for (const auto &updated_state : updated_states) {
     CLOGI("sending text: %.*s", static_cast<int>(updated_state.size()), updated_state.c_str());
-    const auto ret = esp_websocket_client_send_text(web_socket_client_, updated_state.c_str(), updated_state.size(), pdMS_TO_TICKS(5000));
+    const auto ret = esp_websocket_client_send_text(web_socket_client_, updated_state.c_str(), updated_state.size(), pdMS_TO_TICKS(kSendTimeoutMs));
     if (ret != updated_state.size()) {
       CLOGE("sending failed");
     } else {
@@ -705,6 +1397,51 @@ void EngineImpl::SendIotUpdatedStates(const bool force) {
   }
 }
 
+void EngineImpl::StartStateTimer(const State state) {
+  // Falls back to standby when the server does not move the engine on, on the main strand like state changes.
+  switch (state) {
+    case State::kWebsocketConnecting:
+    case State::kWebsocketConnectingWithWakeup:
+    case State::kWebsocketConnected:
+    case State::kWebsocketConnectedWithWakeup:
+    case State::kStandbyConnecting: {
+      // A connection attempt goes through several states, its timer keeps running across them.
+      if (!state_timer_connecting_) {
+        state_timer_connecting_ = true;
+        state_timer_ = task_queue_.StartTimer(kConnectTimeout, Strand::Duration::zero(), kStateTimeoutTolerance, [this]() { OnStateTimeout(); });
+      }
+      return;
+    }
+    case State::kListening: {
+      state_timer_ = task_queue_.StartTimer(kListenTimeout, Strand::Duration::zero(), kStateTimeoutTolerance, [this]() { OnStateTimeout(); });
+      break;
+    }
+    case State::kStandbyConnected: {
+      // The TTL runs from the end of the conversation, across the sessions restored in the background.
+      const auto ttl = std::max<Strand::Duration>(warm_deadline_ - std::chrono::steady_clock::now(), Strand::Duration::zero());
+      state_timer_ = task_queue_.StartTimer(ttl, Strand::Duration::zero(), kStateTimeoutTolerance, [this]() { OnStateTimeout(); });
+      break;
+    }
+    default: {
+      state_timer_.Cancel();
+      break;
+    }
+  }
+  state_timer_connecting_ = false;
+}
+
+void EngineImpl::OnStateTimeout() {
+  CLOGW("timed out in state: %u", state_);
+  if (state_ == State::kListening && keep_warm_ttl_ > 0) {
+    EnterWarmStandby();
+    return;
+  }
+
+  // Not restored in the background once given up on, nor after the TTL of a warm session.
+  warm_deadline_ = std::chrono::steady_clock::time_point();
+  DisconnectWebSocket();
+}
+
 void EngineImpl::ChangeState(const State new_state) {
   auto convert_state = [](const State state) {
     switch (state) {
@@ -721,6 +1458,8 @@ void EngineImpl::ChangeState(const State new_state) {
       case State::kWebsocketConnected:
         return ChatState::kConnecting;
       case State::kStandby:
+      case State::kStandbyConnecting:
+      case State::kStandbyConnected:
         return ChatState::kStandby;
       case State::kListening:
         return ChatState::kListening;
@@ -737,6 +1476,9 @@ void EngineImpl::ChangeState(const State new_state) {
     observer_->PushEvent(Observer::StateChangedEvent{chat_state_, new_chat_state});
   }
 
+  if (new_state != state_) {
+    StartStateTimer(new_state);
+  }
   state_ = new_state;
   chat_state_ = new_chat_state;
 }
@@ -7,6 +7,7 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 
+#include <atomic>
 #include <condition_variable>
 #include <cstdint>
 #include <list>
@@ -19,14 +20,21 @@
 
 #include "ai_vox_engine.h"
 #include "espressif_esp_websocket_client/esp_websocket_client.h"
+#include "boot_timeline.h"
+#include "executor/executor.h"
+#include "fetch_config.h"
 #include "flex_array/flex_array.h"
 #include "iot/iot_manager.h"
-#include "task_queue/task_queue.h"
 
 struct button_dev_t;
+class AudioCaptureService;
 class AudioInputEngine;
 class AudioOutputEngine;
+class OpusPacketAggregator;
+class OpusRateController;
+class TlsSessionCache;
 class WakeNet;
+class WebsocketMessageAssembler;
 namespace ai_vox {
 
 class EngineImpl : public Engine {
@@ -39,6 +47,14 @@ class EngineImpl : public Engine {
   void SetOtaUrl(const std::string url) override;
   void ConfigWebsocket(const std::string url, const std::map<std::string, std::string> headers) override;
   void RegisterIotEntity(std::shared_ptr<iot::Entity> entity) override;
+  void SetPreRollDuration(const uint32_t duration_ms) override;
+  void SetLocalVad(const bool enable, const uint32_t end_of_speech_duration_ms) override;
+  void SetFullDuplex(const bool enable, const bool local_barge_in) override;
+  void SetMaxWebsocketMessageSize(const size_t size) override;
+  void SetAudioAggregation(const uint32_t max_packets) override;
+  void SetKeepWarm(const uint32_t idle_ttl_ms) override;
+  void SetTlsSessionCache(const bool enable, const bool persistent) override;
+  void SetConfigCacheTtl(const uint32_t ttl_sec) override;
   void Start(std::shared_ptr<AudioInputDevice> audio_input_device, std::shared_ptr<AudioOutputDevice> audio_output_device) override;
 
  private:
@@ -51,10 +67,17 @@ class EngineImpl : public Engine {
     kWebsocketConnected,
     kWebsocketConnectedWithWakeup,
     kStandby,
+    kStandbyConnecting,  // restoring the session of the keep-warm mode in the background
+    kStandbyConnected,   // the session is kept warm
     kListening,
     kSpeaking,
   };
 
+  struct LoadedConfig {
+    std::optional<Config> config;
+    bool cached = false;
+  };
+
   EngineImpl(const EngineImpl &) = delete;
   EngineImpl &operator=(const EngineImpl &) = delete;
 
@@ -63,22 +86,50 @@ class EngineImpl : public Engine {
 
   void OnButtonClick();
   void OnWebsocketEvent(esp_event_base_t base, int32_t event_id, void *event_data);
-  void OnAudioFrame(FlexArray<uint8_t> &&data);
+  void OnWebsocketMessage(const uint8_t op_code, FlexArray<uint8_t> &&message);
+  void OnWebsocketMessageDropped(const uint8_t op_code);
   void OnJsonData(FlexArray<uint8_t> &&data);
   void OnWebSocketConnected();
   void OnWebSocketDisconnected();
   void OnAudioOutputDataConsumed();
   void OnTriggered();
   void OnWakeUp();
+  void OnEndOfSpeech();
+  void OnSpeechDetected();
 
+  void StartBoot(std::shared_ptr<AudioInputDevice> &&audio_input_device);
+  void LoadBootConfig(const int64_t wifi_start_time);
+  void InitAudio(std::shared_ptr<AudioInputDevice> &&audio_input_device);
+  void OnBootChainDone();
+  void FinishBoot();
+  bool PreconnectTls();
+  LoadedConfig LoadConfig();
+  void OnConfigLoaded(LoadedConfig &&loaded);
   void LoadProtocol();
-  void StartListening();
+  void RefreshConfig();
+  void OnConfigRefreshed(std::optional<Config> &&config);
+  void InvalidateConfig();
+  void StartListening(const bool wake_word_detected);
+  void SendWakeWordDetected();
+  void SendListenStop(const std::string &session_id);
+  void EnterWarmStandby();
+  void ResumeWarmSession(const bool wake_word_detected);
+  void ReconnectInBackground();
+  void CreateAudioInputEngine();
+  void TransmitAudio(FlexArray<uint8_t> &&data);
+  void SendAggregatedAudio();
+  int64_t SendAudio(uint8_t *buffer, const size_t size, const uint32_t packets);
+  void PauseUplink();
+  void ClearTransmitQueue();
   void AbortSpeaking();
   void AbortSpeaking(const std::string &reason);
+  void FlushPlayback();
   bool ConnectWebSocket();
   void DisconnectWebSocket();
   void SendIotDescriptions();
   void SendIotUpdatedStates(const bool force);
+  void StartStateTimer(const State state);
+  void OnStateTimeout();
   void ChangeState(const State new_state);
 
   mutable std::mutex mutex_;
@@ -86,24 +137,59 @@ class EngineImpl : public Engine {
   ChatState chat_state_ = ChatState::kIdle;
   button_dev_t *button_handle_ = nullptr;
   gpio_num_t trigger_pin_ = GPIO_NUM_0;
-  std::shared_ptr<AudioInputDevice> audio_input_device_;
+  std::shared_ptr<AudioCaptureService> audio_capture_service_;
   std::shared_ptr<AudioOutputDevice> audio_output_device_;
+  std::shared_ptr<BufferPool> pcm_pool_;
+  std::shared_ptr<BufferPool> opus_pool_;
+  std::shared_ptr<BufferPool> text_pool_;
+  std::shared_ptr<OpusRateController> opus_rate_controller_;
   std::shared_ptr<Observer> observer_;
   ai_vox::iot::Manager iot_manager_;
   esp_websocket_client_handle_t web_socket_client_ = nullptr;
+  std::unique_ptr<WebsocketMessageAssembler> message_assembler_;
+  size_t max_websocket_message_size_ = 16 << 10;
+  bool tls_session_cache_enabled_ = false;
+  bool tls_session_cache_persistent_ = false;
+  std::unique_ptr<TlsSessionCache> tls_session_cache_;
   std::string uuid_;
   std::string session_id_;
   std::shared_ptr<AudioInputEngine> audio_input_engine_;
   std::shared_ptr<AudioOutputEngine> audio_output_engine_;
   std::string ota_url_;
+  uint32_t config_cache_ttl_ = 0;  // s
   std::string websocket_url_;
   std::map<std::string, std::string> websocket_headers_;
 #ifdef ARDUINO_ESP32S3_DEV
-  std::unique_ptr<WakeNet> wake_net_;
+  std::shared_ptr<WakeNet> wake_net_;
 #endif
-  TaskQueue task_queue_;
-  std::unique_ptr<TaskQueue> transmit_queue_;
+  std::shared_ptr<Executor> executor_;
+  Strand task_queue_;
+  Strand background_;                    // config requests and the TLS pre-connect, they post their results to |task_queue_|
+  std::unique_ptr<Strand> boot_strand_;  // only during the start, runs the audio stages on the audio pool
+  bool config_loading_ = false;          // a config request is pending on |background_|
+  Strand::TimerHandle config_refresh_timer_;
+  BootTimeline boot_timeline_;
+  uint32_t boot_chains_ = 0;  // chains of boot stages still running, on |task_queue_|
+  LoadedConfig boot_config_;
+  int64_t boot_standby_time_ = 0;  // us since power-on
+  std::unique_ptr<Strand> transmit_queue_;
+  std::unique_ptr<OpusPacketAggregator> uplink_aggregator_;  // used on |transmit_queue_|
+  Strand::TimerHandle aggregate_timer_;                       // sends a message the next packets are late to complete
+  std::atomic<bool> length_prefixed_audio_ = false;           // agreed in the server hello
+  uint32_t max_packets_per_message_ = 1;
+  Strand::TimerHandle state_timer_;
+  bool state_timer_connecting_ = false;
+  uint32_t keep_warm_ttl_ = 0;  // ms
+  std::chrono::steady_clock::time_point warm_deadline_;
+  Strand::TimerHandle reconnect_timer_;
+  uint32_t reconnect_attempts_ = 0;
+  bool hello_sent_ = false;
   const uint32_t audio_frame_duration_ = 60;
+  uint32_t pre_roll_duration_ = 1500;
+  bool local_vad_ = false;
+  uint32_t end_of_speech_duration_ = 0;
+  bool full_duplex_ = false;
+  bool local_barge_in_ = false;
 };
 }  // namespace ai_vox
 
@@ -0,0 +1,113 @@
+#include "audio_capture_service.h"
+
+#include <cstring>
+
+#include "executor/executor.h"
+#include "opus_sample_rate/opus_sample_rate.h"
+#include "silk_resampler.h"
+
+#ifndef CLOGGER_SEVERITY
+#define CLOGGER_SEVERITY CLOGGER_SEVERITY_WARN
+#endif
+#include "clogger/clogger.h"
+
+namespace {
+constexpr uint32_t kStackSize = 4 << 10;
+constexpr size_t kReferenceRingChunks = 16;  // covers the output DMA buffers plus decoded frames written ahead of them
+constexpr size_t kReferencePrimeChunks = 2;   // buffered before a new playback is followed, absorbs the bursty frame writes
+}  // namespace
+
+AudioCaptureService::AudioCaptureService(std::shared_ptr<ai_vox::AudioInputDevice> audio_input_device,
+                                         const uint32_t chunk_duration,
+                                         const bool native_sample_rate,
+                                         const bool echo_reference)
+    : audio_input_device_(std::move(audio_input_device)), exit_sem_(xSemaphoreCreateBinary()) {
+  CLOGI();
+  audio_input_device_->OpenInput(kSampleRate);
+  const auto input_sample_rate = audio_input_device_->input_sample_rate();
+  if (native_sample_rate && IsOpusSampleRate(input_sample_rate)) {
+    sample_rate_ = input_sample_rate;
+  }
+
+  chunk_ = FlexArray<int16_t>(sample_rate_ / 1000 * chunk_duration);
+  if (input_sample_rate != sample_rate_) {
+    CLOGD("init resampler for %" PRIu32 " -> %" PRIu32, input_sample_rate, sample_rate_);
+    resampler_ = std::make_unique<SilkResampler>(input_sample_rate, sample_rate_);
+    capture_buffer_ = FlexArray<int16_t>(input_sample_rate / 1000 * chunk_duration);
+  }
+
+  if (echo_reference) {
+    reference_chunk_ = FlexArray<int16_t>(chunk_.size());
+    reference_ring_ = std::make_unique<SpscRingBuffer<int16_t>>(chunk_.size() * kReferenceRingChunks);
+  }
+
+  stack_buffer_ = new StackType_t[kStackSize];
+  // Blocks on the device all the time, it keeps a task of its own rather than holding a worker of the audio pool.
+  task_handle_ = xTaskCreateStaticPinnedToCore(
+      &Loop, "AudioCapture", kStackSize, this, tskIDLE_PRIORITY + 2, stack_buffer_, &task_buffer_, Executor::kAudioCoreId);
+  assert(task_handle_ != nullptr);
+  if (task_handle_ == nullptr) {
+    abort();
+  }
+  CLOGI("OK");
+}
+
+AudioCaptureService::~AudioCaptureService() {
+  running_ = false;
+  xSemaphoreTake(exit_sem_, portMAX_DELAY);
+  vTaskDelete(task_handle_);
+  delete[] stack_buffer_;
+  vSemaphoreDelete(exit_sem_);
+  audio_input_device_->CloseInput();
+  if (reference_overrun_count_ > 0) {
+    CLOGW("echo reference overruns: %" PRIu32, reference_overrun_count_.load());
+  }
+}
+
+void AudioCaptureService::WriteReference(const int16_t* pcm, const size_t samples) {
+  if (!reference_ring_) {
+    return;
+  }
+
+  if (!reference_ring_->Write(pcm, samples)) {
+    reference_overrun_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void AudioCaptureService::Loop(void* self) {
+  reinterpret_cast<AudioCaptureService*>(self)->Loop();
+}
+
+void AudioCaptureService::Loop() {
+  while (running_) {
+    Capture();
+  }
+  xSemaphoreGive(exit_sem_);
+  vTaskDelay(portMAX_DELAY);
+}
+
+void AudioCaptureService::Capture() {
+  if (resampler_) {
+    audio_input_device_->Read(capture_buffer_.data(), capture_buffer_.size());
+    resampler_->Resample(capture_buffer_.data(), capture_buffer_.size(), chunk_.data());
+  } else {
+    audio_input_device_->Read(chunk_.data(), chunk_.size());
+  }
+
+  if (!reference_ring_) {
+    Publish(chunk_.data(), nullptr, chunk_.size());
+    return;
+  }
+
+  // Consumed at the capture pace, its delay to the echo stays constant. Running dry primes the next playback again.
+  size_t reference_samples = 0;
+  if (!reference_playing_ && reference_ring_->Size() >= reference_chunk_.size() * kReferencePrimeChunks) {
+    reference_playing_ = true;
+  }
+  if (reference_playing_) {
+    reference_samples = reference_ring_->ReadSome(reference_chunk_.data(), reference_chunk_.size());
+    reference_playing_ = reference_samples == reference_chunk_.size();
+  }
+  memset(reference_chunk_.data() + reference_samples, 0, (reference_chunk_.size() - reference_samples) * sizeof(int16_t));
+  Publish(chunk_.data(), reference_chunk_.data(), chunk_.size());
+}
\ No newline at end of file
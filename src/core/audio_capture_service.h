@@ -0,0 +1,61 @@
+#pragma once
+
+#ifndef _AUDIO_CAPTURE_SERVICE_H_
+#define _AUDIO_CAPTURE_SERVICE_H_
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <memory>
+
+#include "audio_device/audio_input_device.h"
+#include "audio_source.h"
+#include "flex_array/flex_array.h"
+#include "spsc_ring_buffer/spsc_ring_buffer.h"
+
+class SilkResampler;
+
+// Reads the microphone on its own task and publishes every chunk to all subscribers. |native_sample_rate| keeps the device rate
+// when Opus takes it, |echo_reference| publishes the playback written to WriteReference() alongside.
+class AudioCaptureService : public AudioSource {
+ public:
+  AudioCaptureService(std::shared_ptr<ai_vox::AudioInputDevice> audio_input_device,
+                      const uint32_t chunk_duration,
+                      const bool native_sample_rate,
+                      const bool echo_reference);
+  ~AudioCaptureService();
+
+  size_t chunk_samples() const {
+    return chunk_.size();
+  }
+
+  bool has_echo_reference() const {
+    return reference_ring_ != nullptr;
+  }
+
+  // |pcm| at sample_rate(), called from a single playback task.
+  void WriteReference(const int16_t* pcm, const size_t samples);
+
+ private:
+  static void Loop(void* self);
+  void Loop();
+  void Capture();
+
+  std::shared_ptr<ai_vox::AudioInputDevice> audio_input_device_;
+  std::unique_ptr<SilkResampler> resampler_;
+  FlexArray<int16_t> capture_buffer_;
+  FlexArray<int16_t> chunk_;
+  FlexArray<int16_t> reference_chunk_;
+  std::unique_ptr<SpscRingBuffer<int16_t>> reference_ring_;
+  std::atomic<uint32_t> reference_overrun_count_ = 0;
+  bool reference_playing_ = false;
+  std::atomic<bool> running_ = true;
+  SemaphoreHandle_t exit_sem_ = nullptr;
+  StackType_t* stack_buffer_ = nullptr;
+  StaticTask_t task_buffer_;
+  TaskHandle_t task_handle_ = nullptr;
+};
+
+#endif
\ No newline at end of file
@@ -1,7 +1,11 @@
 #include "audio_input_engine.h"
 
+#include <esp_timer.h>
+
+#include "audio_source.h"
 #include "libopus/opus.h"
-#include "silk_resampler.h"
+#include "opus_rate_controller.h"
+#include "voice_activity_detector.h"
 
 #ifndef CLOGGER_SEVERITY
 #define CLOGGER_SEVERITY CLOGGER_SEVERITY_WARN
@@ -10,20 +14,41 @@
 #include "clogger/clogger.h"
 
 namespace {
-constexpr size_t kMaxOpusPacketSize = 1500;
-constexpr uint32_t kFrameDuration = 20;                          // ms
-constexpr uint32_t kDefaultSampleRate = 16000;                   // Hz
-constexpr uint32_t kDefaultChannels = 1;                         // Mono
-constexpr size_t kMaxFrameSize = 16000 / 1000 * kFrameDuration;  // 16000 Hz * 20 ms
+constexpr uint32_t kDefaultChannels = 1;  // Mono
+constexpr uint32_t kKeepAliveFrames = 8;  // one silent frame in every kKeepAliveFrames is still sent
+constexpr uint32_t kMaxFramesPerRun = 4;  // encoded before the strand yields, a backlog such as the pre-roll is worked off in runs
+
+size_t CaptureRingFrames() {
+  return heap_caps_get_total_size(MALLOC_CAP_SPIRAM) == 0 ? 4 : 8;
+}
 }  // namespace
 
-AudioInputEngine::AudioInputEngine(std::shared_ptr<ai_vox::AudioInputDevice> audio_input_device,
+AudioInputEngine::AudioInputEngine(std::shared_ptr<Executor> executor,
+                                   std::shared_ptr<AudioSource> audio_source,
                                    AudioInputEngine::DataHandler &&handler,
-                                   const uint32_t frame_duration)
-    : handler_(std::move(handler)), audio_input_device_(std::move(audio_input_device)) {
+                                   const uint32_t frame_duration,
+                                   std::shared_ptr<BufferPool> opus_pool,
+                                   std::shared_ptr<OpusRateController> rate_controller,
+                                   std::unique_ptr<VoiceActivityDetector> vad,
+                                   std::function<void()> &&end_of_speech_handler,
+                                   const uint32_t pre_roll_duration,
+                                   const size_t headroom)
+    : handler_(std::move(handler)),
+      audio_source_(std::move(audio_source)),
+      opus_pool_(std::move(opus_pool)),
+      rate_controller_(std::move(rate_controller)),
+      vad_(std::move(vad)),
+      end_of_speech_handler_(std::move(end_of_speech_handler)),
+      frame_samples_(audio_source_->sample_rate() / 1000 * frame_duration),
+      frame_duration_us_(frame_duration * 1000),
+      headroom_(headroom),
+      encode_buffer_(frame_samples_),
+      previous_frame_(vad_ ? frame_samples_ : 0),
+      pcm_ring_(frame_samples_ * CaptureRingFrames() + audio_source_->sample_rate() / 1000 * pre_roll_duration),
+      strand_(std::make_unique<Strand>(std::move(executor), Executor::Pool::kAudio, tskIDLE_PRIORITY + 1)) {
   CLOGI();
   int error = 0;
-  opus_encoder_ = opus_encoder_create(kDefaultSampleRate, kDefaultChannels, OPUS_APPLICATION_VOIP, &error);
+  opus_encoder_ = opus_encoder_create(audio_source_->sample_rate(), kDefaultChannels, OPUS_APPLICATION_VOIP, &error);
   assert(opus_encoder_ != nullptr);
   if (opus_encoder_ == nullptr) {
     CLOG("opus_encoder_create failed: %d", error);
@@ -31,81 +56,175 @@ AudioInputEngine::AudioInputEngine(std::shared_ptr<ai_vox::AudioInputDevice> aud
     return;
   }
 
-  uint32_t stack_size = 32 << 10;
   opus_encoder_ctl(opus_encoder_, OPUS_SET_DTX(1));
-  if (heap_caps_get_total_size(MALLOC_CAP_SPIRAM) == 0) {
-    opus_encoder_ctl(opus_encoder_, OPUS_SET_COMPLEXITY(0));
-    opus_encoder_ctl(opus_encoder_, OPUS_SET_BITRATE(8000));
-    stack_size = 20 << 10;
-  } else {
-    opus_encoder_ctl(opus_encoder_, OPUS_SET_COMPLEXITY(5));
-  }
-  CLOGI();
-
-  // audio_input_device_->Open(kDefaultSampleRate);
-  audio_input_device_->OpenInput(kDefaultSampleRate);
-  CLOGI();
-
-  if (audio_input_device_->input_sample_rate() != kDefaultSampleRate) {
-    // CLOGI("kDefaultSampleRate: %" PRIu32, kDefaultSampleRate);
-    // CLOGI("audio_input_device->input_sample_rate(): %" PRIu32, audio_input_device_->input_sample_rate());
-    // silk_resampler_ = new silk_resampler_state_struct;
-    // silk_resampler_init(
-    //     reinterpret_cast<silk_resampler_state_struct *>(silk_resampler_), audio_input_device_->input_sample_rate(), kDefaultSampleRate, 1);
-    resampler_ = std::make_unique<SilkResampler>(audio_input_device_->input_sample_rate(), kDefaultSampleRate);
-  }
-  CLOGI();
-  task_queue_ = new TaskQueue("AudioInput", stack_size, tskIDLE_PRIORITY + 1);
-  task_queue_->Enqueue([this, samples = audio_input_device_->input_sample_rate() / 1000 * frame_duration]() { PullData(samples); });
+  ApplyRateLevel();
   CLOGI("OK");
 }
 
 AudioInputEngine::~AudioInputEngine() {
   CLOGI();
-  delete task_queue_;
-  // delete reinterpret_cast<silk_resampler_state_struct *>(silk_resampler_);
-  audio_input_device_->CloseInput();
+  Pause();
+  // Waits for the frame in progress.
+  strand_.reset();
   opus_encoder_destroy(opus_encoder_);
+  if (overrun_count_ > 0) {
+    CLOGW("capture overruns: %" PRIu32, overrun_count_.load());
+  }
+  CLOGI("opus level: %zu, downgrades: %" PRIu32 ", upgrades: %" PRIu32 ", dropped frames: %" PRIu32,
+        rate_controller_->level_index(),
+        rate_controller_->downgrade_count(),
+        rate_controller_->upgrade_count(),
+        rate_controller_->dropped_frames());
   CLOG("OK");
 }
 
-FlexArray<int16_t> AudioInputEngine::ReadPcm(const uint32_t samples) {
-  FlexArray<int16_t> pcm(samples);
-  audio_input_device_->Read(pcm.data(), pcm.size());
-  if (resampler_) {
-    return resampler_->Resample(std::move(pcm));
+bool AudioInputEngine::AppendPreRoll(const int16_t *pcm, const size_t samples) {
+  // While unsubscribed the ring has no other producer.
+  if (active_) {
+    return false;
+  }
+
+  if (!pcm_ring_.Write(pcm, samples)) {
+    CLOGW("pre-roll of %zu samples dropped, the capture ring is full", samples);
+    return false;
+  }
+  return true;
+}
+
+void AudioInputEngine::Resume() {
+  CLOGI();
+  // Queued before the first chunk of the new stream can schedule an encode.
+  strand_->Enqueue([this]() {
+    Reset();
+    // Starts with the pre-roll, if any. Chunks captured while a pause was pending did not schedule an encode of their own.
+    Encode();
+  });
+
+  if (!active_.exchange(true)) {
+    subscription_ = audio_source_->Subscribe(
+        [this](const int16_t *pcm, const int16_t * /* reference */, const size_t samples) { OnCapturedPcm(pcm, samples); });
+  }
+}
+
+void AudioInputEngine::Pause(std::function<void()> &&paused_callback) {
+  if (active_.exchange(false)) {
+    CLOGI();
+    audio_source_->Unsubscribe(subscription_);
+  }
+
+  // Drops the paused stream up to where the source stopped writing, a Resume() meanwhile writes the next one.
+  const auto stream_end = pcm_ring_.write_position();
+  pending_pauses_.fetch_add(1, std::memory_order_acq_rel);
+  strand_->Enqueue([this, stream_end, paused_callback = std::move(paused_callback)]() {
+    pcm_ring_.ClearUntil(stream_end);
+    pending_pauses_.fetch_sub(1, std::memory_order_acq_rel);
+    if (paused_callback) {
+      paused_callback();
+    }
+  });
+}
+
+void AudioInputEngine::Reset() {
+  // OPUS_RESET_STATE keeps the bitrate, complexity and bandwidth set by the rate controller.
+  opus_encoder_ctl(opus_encoder_, OPUS_RESET_STATE);
+  if (vad_) {
+    vad_->Reset();
+  }
+  previous_frame_pending_ = false;
+  silent_frames_ = 0;
+  end_of_speech_ = false;
+}
+
+void AudioInputEngine::Encode() {
+  // Cleared first, a chunk captured from now on schedules another run.
+  encode_scheduled_ = false;
+  // A pause not handled yet ends the stream being encoded, even when a Resume() already started the next one.
+  uint32_t frames = 0;
+  while (active_ && pending_pauses_.load(std::memory_order_acquire) == 0 && pcm_ring_.Read(encode_buffer_.data(), frame_samples_)) {
+    ProcessFrame(encode_buffer_.data());
+    if (++frames == kMaxFramesPerRun) {
+      // The rest in another run, after a Pause() queued meanwhile and with the tasks of other strands in between.
+      if (!encode_scheduled_.exchange(true)) {
+        strand_->Enqueue([this]() { Encode(); });
+      }
+      return;
+    }
+  }
+}
+
+void AudioInputEngine::OnCapturedPcm(const int16_t *pcm, const size_t samples) {
+  // On the source task, which must not wait for the encoder: a chunk that does not fit is dropped.
+  if (!pcm_ring_.Write(pcm, samples)) {
+    if (overrun_count_.fetch_add(1, std::memory_order_relaxed) == 0) {
+      CLOGW("capture ring overrun, encoder is falling behind");
+    }
+  }
+
+  if (!encode_scheduled_.exchange(true)) {
+    strand_->Enqueue([this]() { Encode(); });
+  }
+}
+
+void AudioInputEngine::ProcessFrame(const int16_t *pcm) {
+  if (!vad_) {
+    EncodePcm(pcm, frame_samples_);
+    return;
+  }
+
+  if (end_of_speech_) {
+    return;
+  }
+
+  const auto result = vad_->Process(pcm, frame_samples_);
+  if (result.end_of_speech) {
+    CLOGI("end of speech");
+    end_of_speech_ = true;
+    if (end_of_speech_handler_) {
+      end_of_speech_handler_();
+    }
+    return;
+  }
+
+  if (result.speech) {
+    // Send the silent frame right before the onset too, so that the start of the first word is not clipped.
+    if (previous_frame_pending_) {
+      EncodePcm(previous_frame_.data(), frame_samples_);
+      previous_frame_pending_ = false;
+    }
+    silent_frames_ = 0;
+    EncodePcm(pcm, frame_samples_);
+    return;
+  }
+
+  if (silent_frames_++ % kKeepAliveFrames == 0) {
+    previous_frame_pending_ = false;
+    EncodePcm(pcm, frame_samples_);
   } else {
-    return pcm;
+    memcpy(previous_frame_.data(), pcm, frame_samples_ * sizeof(int16_t));
+    previous_frame_pending_ = true;
   }
-  // return resampler_ ? resampler_->Resample(std::move(pcm)) : pcm;
 }
 
-// FlexArray<int16_t> AudioInputEngine::Resample(FlexArray<int16_t> &&input_pcm) {
-//   if (silk_resampler_ == nullptr) {
-//     return input_pcm;
-//   }
-
-//   FlexArray<int16_t> resampled_pcm(input_pcm.size() * kDefaultSampleRate / audio_input_device_->input_sample_rate());
-//   const auto ret =
-//       silk_resampler(reinterpret_cast<silk_resampler_state_struct *>(silk_resampler_), resampled_pcm.data(), input_pcm.data(), input_pcm.size());
-//   if (ret != 0) {
-//     CLOGE("silk_resampler_process failed with: %d", ret);
-//     abort();
-//   }
-//   return resampled_pcm;
-// }
-
-void AudioInputEngine::PullData(const uint32_t samples) {
-  auto pcm = ReadPcm(samples);
-  FlexArray<uint8_t> data(kMaxOpusPacketSize);
-  const auto ret = opus_encode(opus_encoder_, pcm.data(), pcm.size(), data.data(), data.size());
+void AudioInputEngine::EncodePcm(const int16_t *pcm, const uint32_t samples) {
+  FlexArray<uint8_t> data(opus_pool_.get(), opus_pool_->slab_size());
+  const auto start_time = esp_timer_get_time();
+  const auto ret = opus_encode(opus_encoder_, pcm, samples, data.data() + headroom_, data.size() - headroom_);
+  if (rate_controller_->Update(esp_timer_get_time() - start_time, frame_duration_us_)) {
+    ApplyRateLevel();
+  }
+
   if (ret > 0) {
-    data.Resize(ret);
+    data.Resize(headroom_ + ret);
     handler_(std::move(data));
   } else {
     CLOGE("opus_encode failed with: %d", ret);
     abort();
   }
+}
 
-  task_queue_->Enqueue([this, samples]() { PullData(samples); });
+void AudioInputEngine::ApplyRateLevel() {
+  const auto &level = rate_controller_->level();
+  opus_encoder_ctl(opus_encoder_, OPUS_SET_BITRATE(level.bitrate));
+  opus_encoder_ctl(opus_encoder_, OPUS_SET_COMPLEXITY(level.complexity));
+  opus_encoder_ctl(opus_encoder_, OPUS_SET_BANDWIDTH(level.bandwidth));
 }
\ No newline at end of file
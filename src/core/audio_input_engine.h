@@ -3,36 +3,83 @@
 #ifndef _AUDIO_INPUT_ENGINE_H_
 #define _AUDIO_INPUT_ENGINE_H_
 
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <atomic>
 #include <functional>
 #include <memory>
 
-#include "audio_device//audio_input_device.h"
+#include "executor/executor.h"
 #include "flex_array/flex_array.h"
-#include "task_queue/task_queue.h"
+#include "spsc_ring_buffer/spsc_ring_buffer.h"
 
 struct OpusDecoder;
-class SilkResampler;
+class AudioSource;
+class OpusRateController;
+class VoiceActivityDetector;
 class AudioInputEngine {
  public:
   using DataHandler = std::function<void(FlexArray<uint8_t> &&)>;
 
-  explicit AudioInputEngine(std::shared_ptr<ai_vox::AudioInputDevice> audio_input_device,
+  // Encodes on an audio strand of |executor|, paused until Resume(). Frames handed to |handler| start with |headroom| free bytes.
+  explicit AudioInputEngine(std::shared_ptr<Executor> executor,
+                            std::shared_ptr<AudioSource> audio_source,
                             AudioInputEngine::DataHandler &&handler,
-                            const uint32_t frame_duration);
+                            const uint32_t frame_duration,
+                            std::shared_ptr<BufferPool> opus_pool,
+                            std::shared_ptr<OpusRateController> rate_controller,
+                            std::unique_ptr<VoiceActivityDetector> vad,
+                            std::function<void()> &&end_of_speech_handler,
+                            const uint32_t pre_roll_duration = 0,
+                            const size_t headroom = 0);
   ~AudioInputEngine();
 
+  // Audio streamed ahead of the source by the next Resume(). False when streaming or when it does not fit.
+  bool AppendPreRoll(const int16_t *pcm, const size_t samples);
+  // Streams the source after the pre-roll, the encoder and the end of speech detection starting over.
+  void Resume();
+  // Drops what is not encoded yet. |paused_callback| runs on the encoder strand after the last frame of the stream.
+  void Pause(std::function<void()> &&paused_callback = nullptr);
+
+  // Number of captured chunks dropped because the encoder fell behind and the capture ring was full.
+  uint32_t overrun_count() const {
+    return overrun_count_.load(std::memory_order_relaxed);
+  }
+
  private:
   AudioInputEngine(const AudioInputEngine &) = delete;
   AudioInputEngine &operator=(const AudioInputEngine &) = delete;
 
-  FlexArray<int16_t> ReadPcm(const uint32_t samples);
-  void PullData(const uint32_t samples);
+  void Reset();
+  void Encode();
+  void OnCapturedPcm(const int16_t *pcm, const size_t samples);
+  void ProcessFrame(const int16_t *pcm);
+  void EncodePcm(const int16_t *pcm, const uint32_t samples);
+  void ApplyRateLevel();
 
   const DataHandler handler_;
-  std::shared_ptr<ai_vox::AudioInputDevice> audio_input_device_;
+  std::shared_ptr<AudioSource> audio_source_;
+  std::shared_ptr<BufferPool> opus_pool_;
+  std::shared_ptr<OpusRateController> rate_controller_;
+  std::unique_ptr<VoiceActivityDetector> vad_;
+  const std::function<void()> end_of_speech_handler_;
   struct OpusEncoder *opus_encoder_ = nullptr;
-  std::unique_ptr<SilkResampler> resampler_;
-  TaskQueue *task_queue_ = nullptr;
+  const uint32_t frame_samples_ = 0;
+  const int64_t frame_duration_us_ = 0;
+  const size_t headroom_ = 0;
+  FlexArray<int16_t> encode_buffer_;
+  FlexArray<int16_t> previous_frame_;
+  bool previous_frame_pending_ = false;
+  uint32_t silent_frames_ = 0;
+  bool end_of_speech_ = false;
+  SpscRingBuffer<int16_t> pcm_ring_;
+  std::atomic<bool> active_ = false;
+  std::atomic<bool> encode_scheduled_ = false;
+  std::atomic<uint32_t> pending_pauses_ = 0;  // Pause() calls whose task has not run yet
+  std::atomic<uint32_t> overrun_count_ = 0;
+  uint32_t subscription_ = 0;
+  std::unique_ptr<Strand> strand_;
 };
 
 #endif
\ No newline at end of file
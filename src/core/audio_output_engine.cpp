@@ -1,7 +1,10 @@
 #include "audio_output_engine.h"
 
+#include "audio_capture_service.h"
+#include "executor/executor.h"
 #include "flex_array/flex_array.h"
 #include "libopus/opus.h"
+#include "opus_sample_rate/opus_sample_rate.h"
 #include "silk_resampler.h"
 
 #ifndef CLOGGER_SEVERITY
@@ -14,56 +17,262 @@ constexpr uint32_t kDefaultSampleRate = 24000;
 constexpr uint32_t kDefaultChannels = 1;
 constexpr uint32_t kDefaultDurationMs = 20;  // Duration in milliseconds
 constexpr uint32_t kDefaultFrameSize = kDefaultSampleRate / 1000 * kDefaultChannels * kDefaultDurationMs;
+// Above the uplink encoder: a late frame is heard, the encoder has its capture ring to catch up from.
+constexpr UBaseType_t kPriority = tskIDLE_PRIORITY + 2;
+// Closes the output device once nothing played for that long, pauses in an answer are shorter.
+constexpr auto kOutputIdleTimeout = std::chrono::seconds(3);
+constexpr auto kOutputIdleTolerance = std::chrono::milliseconds(500);
+
+size_t JitterBufferCapacity(const uint32_t frame_duration) {
+  // The server sends a sentence faster than real time, the buffer holds the burst of a long one rather than dropping its tail.
+  const uint32_t duration_ms = heap_caps_get_total_size(MALLOC_CAP_SPIRAM) == 0 ? 3000 : 10000;
+  return duration_ms / frame_duration;
+}
 }  // namespace
 
-AudioOutputEngine::AudioOutputEngine(std::shared_ptr<ai_vox::AudioOutputDevice> audio_output_device, const uint32_t frame_duration)
-    : audio_output_device_(std::move(audio_output_device)), samples_(kDefaultSampleRate / 1000 * kDefaultChannels * frame_duration) {
+AudioOutputEngine::AudioOutputEngine(std::shared_ptr<Executor> executor,
+                                     std::shared_ptr<ai_vox::AudioOutputDevice> audio_output_device,
+                                     const uint32_t frame_duration,
+                                     std::shared_ptr<BufferPool> pcm_pool,
+                                     std::shared_ptr<BufferPool> opus_pool,
+                                     std::shared_ptr<AudioCaptureService> echo_reference)
+    : audio_output_device_(std::move(audio_output_device)),
+      pcm_pool_(std::move(pcm_pool)),
+      opus_pool_(std::move(opus_pool)),
+      echo_reference_(std::move(echo_reference)),
+      jitter_buffer_(frame_duration, JitterBufferCapacity(frame_duration), opus_pool_.get()),
+      strand_(std::make_unique<Strand>(std::move(executor), Executor::Pool::kAudio, kPriority)) {
   CLOGI();
+  audio_output_device_->OpenOutput(kDefaultSampleRate);
+
+  // Opus decodes natively at the device rate when it is one of its own, the resampler is only needed for other rates.
+  decode_sample_rate_ =
+      IsOpusSampleRate(audio_output_device_->output_sample_rate()) ? audio_output_device_->output_sample_rate() : kDefaultSampleRate;
+  samples_ = decode_sample_rate_ / 1000 * kDefaultChannels * frame_duration;
+
   int error = -1;
-  opus_decoder_ = opus_decoder_create(kDefaultSampleRate, kDefaultChannels, &error);
+  opus_decoder_ = opus_decoder_create(decode_sample_rate_, kDefaultChannels, &error);
   assert(opus_decoder_ != nullptr);
-  audio_output_device_->OpenOutput(kDefaultSampleRate);
 
-  if (audio_output_device_->output_sample_rate() != kDefaultSampleRate) {
-    CLOGD("init resampler for %" PRIu32 " -> %" PRIu32, kDefaultSampleRate, audio_output_device_->output_sample_rate());
-    resampler_ = std::make_unique<SilkResampler>(kDefaultSampleRate, audio_output_device_->output_sample_rate());
+  if (audio_output_device_->output_sample_rate() != decode_sample_rate_) {
+    CLOGD("init resampler for %" PRIu32 " -> %" PRIu32, decode_sample_rate_, audio_output_device_->output_sample_rate());
+    resampler_ = std::make_unique<SilkResampler>(decode_sample_rate_, audio_output_device_->output_sample_rate());
   }
 
-  uint32_t stack_size = 9 << 10;
-  task_queue_ = new TaskQueue("AudioOutput", stack_size, tskIDLE_PRIORITY + 1);
+  if (echo_reference_ && audio_output_device_->output_sample_rate() != echo_reference_->sample_rate()) {
+    reference_resampler_ = std::make_unique<SilkResampler>(audio_output_device_->output_sample_rate(), echo_reference_->sample_rate());
+    reference_buffer_ = FlexArray<int16_t>(echo_reference_->sample_rate() / 1000 * frame_duration);
+  }
+  // Opened to learn its rate, then off until the first answer.
+  audio_output_device_->CloseOutput();
   CLOGI("OK");
 }
 
 AudioOutputEngine::~AudioOutputEngine() {
   CLOGI();
-  delete task_queue_;
-  audio_output_device_->CloseOutput();
+  // Waits for the frame in progress.
+  strand_.reset();
+  CloseOutput();
   opus_decoder_destroy(opus_decoder_);
+  CLOGI("jitter target: %zu, underruns: %" PRIu32 ", overruns: %" PRIu32 ", concealed frames: %" PRIu32 ", fec frames: %" PRIu32,
+        jitter_buffer_.target_depth(),
+        jitter_buffer_.underrun_count(),
+        jitter_buffer_.overrun_count(),
+        concealed_frames_,
+        fec_frames_);
   CLOGI("OK");
 }
 
+void AudioOutputEngine::Open() {
+  jitter_buffer_.Open();
+  // Powered up while the answer is held, the first frame does not wait for the device.
+  open_requested_ = true;
+  Kick();
+}
+
 void AudioOutputEngine::Write(FlexArray<uint8_t>&& data) {
-  task_queue_->Enqueue([this, data = std::move(data)]() mutable { ProcessData(std::move(data)); });
+  // Checked and pushed under the lock of the jitter buffer, a Flush() or Pause() racing with the transport task drops the data.
+  if (jitter_buffer_.Push(std::move(data))) {
+    Kick();
+  }
+}
+
+void AudioOutputEngine::NotifyDataLost() {
+  if (jitter_buffer_.PushLost()) {
+    Kick();
+  }
 }
 
 void AudioOutputEngine::NotifyDataEnd(std::function<void()>&& callback) {
-  task_queue_->Enqueue(std::move(callback));
+  {
+    std::lock_guard lock(mutex_);
+    data_end_callback_ = std::move(callback);
+  }
+  jitter_buffer_.End();
+  Kick();
+}
+
+void AudioOutputEngine::Flush() {
+  jitter_buffer_.Clear();
+  flush_requested_ = true;
+  Kick();
+}
+
+void AudioOutputEngine::Pause() {
+  {
+    std::lock_guard lock(mutex_);
+    data_end_callback_ = nullptr;
+  }
+  jitter_buffer_.Reset();
+  // The decoder state is reset by the fade-out, on the playback task, before anything written afterwards is decoded.
+  flush_requested_ = true;
+  Kick();
+}
+
+void AudioOutputEngine::Resume() {
+  jitter_buffer_.Play();
+  Kick();
 }
 
-void AudioOutputEngine::ProcessData(FlexArray<uint8_t>&& data) {
-  auto pcm = FlexArray<int16_t>(samples_);
+void AudioOutputEngine::Kick() {
+  if (!play_scheduled_.exchange(true)) {
+    strand_->Enqueue([this]() { Play(); });
+  }
+}
 
-  const auto ret = opus_decode(opus_decoder_, data.data(), data.size(), pcm.data(), pcm.size(), 0);
-  if (ret >= 0) {
+void AudioOutputEngine::Play() {
+  // Paced by the device, Write() blocks until the DMA has room. Cleared first, a write from here on schedules another run.
+  play_scheduled_ = false;
+  if (flush_requested_.exchange(false)) {
+    FadeOut();
+  }
+
+  if (open_requested_.exchange(false)) {
+    OpenOutput();
+  }
+
+  FlexArray<uint8_t> packet;
+  switch (jitter_buffer_.Pop(packet)) {
+    case JitterBuffer::Result::kPacket: {
+      Decode(packet.data(), packet.size(), false);
+      break;
+    }
+    case JitterBuffer::Result::kLost: {
+      Decode(packet.data(), packet.size(), packet.size() > 0);
+      break;
+    }
+    case JitterBuffer::Result::kUnderrun: {
+      Decode(nullptr, 0, false);
+      break;
+    }
+    case JitterBuffer::Result::kEnded: {
+      playing_ = false;
+      std::function<void()> callback;
+      {
+        std::lock_guard lock(mutex_);
+        callback = std::move(data_end_callback_);
+        data_end_callback_ = nullptr;
+      }
+      if (callback) {
+        callback();
+      }
+      break;
+    }
+    case JitterBuffer::Result::kBuffering: {
+      playing_ = false;
+      if (output_open_ && !idle_timer_started_) {
+        idle_timer_started_ = true;
+        idle_timer_ = strand_->StartTimer(kOutputIdleTimeout, Strand::Duration::zero(), kOutputIdleTolerance, [this]() {
+          idle_timer_started_ = false;
+          CloseOutput();
+        });
+      }
+      // Until the next write.
+      return;
+    }
+  }
+  Kick();
+}
+
+void AudioOutputEngine::Decode(const uint8_t* data, const size_t size, const bool fec) {
+  auto pcm = FlexArray<int16_t>(pcm_pool_.get(), samples_);
+
+  // Conceals without data, rebuilds the frame from the next packet with |fec|.
+  if (data == nullptr || size == 0) {
+    ++concealed_frames_;
+  } else if (fec) {
+    ++fec_frames_;
+  }
+  const auto ret = opus_decode(opus_decoder_, size > 0 ? data : nullptr, size, pcm.data(), samples_, fec ? 1 : 0);
+  if (ret > 0) {
+    pcm.Resize(ret);
     WritePcm(std::move(pcm));
+    playing_ = true;
+    if (idle_timer_started_) {
+      idle_timer_.Cancel();
+      idle_timer_started_ = false;
+    }
+  } else if (ret < 0) {
+    CLOGW("opus_decode failed with: %d", ret);
+  }
+}
+
+void AudioOutputEngine::FadeOut() {
+  // The concealment frame continues the waveform where playback stopped, ramping it down avoids the click of a hard cut.
+  if (playing_) {
+    auto pcm = FlexArray<int16_t>(pcm_pool_.get(), samples_);
+    const auto ret = opus_decode(opus_decoder_, nullptr, 0, pcm.data(), samples_, 0);
+    if (ret > 0) {
+      auto* samples = pcm.data();
+      for (int i = 0; i < ret; ++i) {
+        samples[i] = static_cast<int16_t>(static_cast<int32_t>(samples[i]) * (ret - 1 - i) / ret);
+      }
+      pcm.Resize(ret);
+      WritePcm(std::move(pcm));
+    }
+    playing_ = false;
+  }
+  opus_decoder_ctl(opus_decoder_, OPUS_RESET_STATE);
+}
+
+void AudioOutputEngine::OpenOutput() {
+  if (!output_open_) {
+    CLOGI("open output");
+    audio_output_device_->OpenOutput(kDefaultSampleRate);
+    output_open_ = true;
+  }
+}
+
+void AudioOutputEngine::CloseOutput() {
+  if (output_open_) {
+    CLOGI("close output");
+    audio_output_device_->CloseOutput();
+    output_open_ = false;
   }
 }
 
 void AudioOutputEngine::WritePcm(FlexArray<int16_t>&& pcm) {
+  OpenOutput();
   if (resampler_) {
     auto resampled_pcm = resampler_->Resample(std::move(pcm));
+    WriteReference(resampled_pcm.data(), resampled_pcm.size());
     audio_output_device_->Write(resampled_pcm.data(), resampled_pcm.size());
   } else {
+    WriteReference(pcm.data(), pcm.size());
     audio_output_device_->Write(pcm.data(), pcm.size());
   }
+}
+
+void AudioOutputEngine::WriteReference(const int16_t* pcm, const size_t samples) {
+  // Written before the device blocks on the DMA, so that the reference always leads the echo picked up by the microphone.
+  if (!echo_reference_) {
+    return;
+  }
+
+  if (reference_resampler_) {
+    const auto reference_samples = reference_resampler_->Resample(pcm, samples, reference_buffer_.data());
+    echo_reference_->WriteReference(reference_buffer_.data(), reference_samples);
+  } else {
+    echo_reference_->WriteReference(pcm, samples);
+  }
 }
\ No newline at end of file
@@ -1,34 +1,80 @@
 #pragma once
 
+#include <freertos/FreeRTOS.h>
+
+#include <atomic>
 #include <functional>
 #include <memory>
+#include <mutex>
 
 #include "audio_device/audio_output_device.h"
+#include "executor/executor.h"
 #include "flex_array/flex_array.h"
-#include "task_queue/task_queue.h"
+#include "jitter_buffer.h"
 
+class AudioCaptureService;
 class OpusDecoder;
 class SilkResampler;
+// Plays the downlink on an audio strand, a frame per run. Data is accepted from Open() to the next Pause() or Flush() and plays
+// from Resume(). The output device is closed once idle for a while.
 class AudioOutputEngine {
  public:
-  explicit AudioOutputEngine(std::shared_ptr<ai_vox::AudioOutputDevice> audio_output_device, const uint32_t frame_duration);
+  AudioOutputEngine(std::shared_ptr<Executor> executor,
+                    std::shared_ptr<ai_vox::AudioOutputDevice> audio_output_device,
+                    const uint32_t frame_duration,
+                    std::shared_ptr<BufferPool> pcm_pool,
+                    std::shared_ptr<BufferPool> opus_pool,
+                    std::shared_ptr<AudioCaptureService> echo_reference = nullptr);
   ~AudioOutputEngine();
 
+  // From the transport task, before the data of an answer. Does nothing for an answer already accepted.
+  void Open();
   void Write(FlexArray<uint8_t>&& data);
+  // Recovered from the FEC of the next packet, concealed without it.
+  void NotifyDataLost();
   void NotifyDataEnd(std::function<void()>&& callback);
+  // Fades out within a frame and drops what is buffered.
+  void Flush();
+  // Drops what is buffered and a pending NotifyDataEnd() callback.
+  void Pause();
+  // Lets the answer accepted by Open() play.
+  void Resume();
 
  private:
   AudioOutputEngine(const AudioOutputEngine&) = delete;
   AudioOutputEngine& operator=(const AudioOutputEngine&) = delete;
 
-  static void Loop(void* self);
-  void Loop();
-  void ProcessData(FlexArray<uint8_t>&& data);
+  // Schedules Play() unless it is already pending.
+  void Kick();
+  void Play();
+  void Decode(const uint8_t* data, const size_t size, const bool fec);
+  void FadeOut();
+  void OpenOutput();
+  void CloseOutput();
   void WritePcm(FlexArray<int16_t>&& pcm);
+  void WriteReference(const int16_t* pcm, const size_t samples);
 
   std::shared_ptr<ai_vox::AudioOutputDevice> audio_output_device_;
+  std::shared_ptr<BufferPool> pcm_pool_;
+  std::shared_ptr<BufferPool> opus_pool_;  // packets of the downlink, kept alive for the jitter buffer
   struct OpusDecoder* opus_decoder_ = nullptr;
   std::unique_ptr<SilkResampler> resampler_;
-  TaskQueue* task_queue_ = nullptr;
-  const uint32_t samples_ = 0;
+  std::shared_ptr<AudioCaptureService> echo_reference_;
+  std::unique_ptr<SilkResampler> reference_resampler_;
+  FlexArray<int16_t> reference_buffer_;
+  uint32_t decode_sample_rate_ = 0;
+  uint32_t samples_ = 0;
+  JitterBuffer jitter_buffer_;
+  std::mutex mutex_;
+  std::function<void()> data_end_callback_;
+  uint32_t concealed_frames_ = 0;
+  uint32_t fec_frames_ = 0;
+  bool playing_ = false;
+  bool output_open_ = false;  // strand only
+  Strand::TimerHandle idle_timer_;  // strand only, closes the output device
+  bool idle_timer_started_ = false;
+  std::atomic<bool> play_scheduled_ = false;
+  std::atomic<bool> open_requested_ = false;
+  std::atomic<bool> flush_requested_ = false;
+  std::unique_ptr<Strand> strand_;
 };
\ No newline at end of file
@@ -0,0 +1,33 @@
+#include "audio_source.h"
+
+namespace {
+constexpr size_t kMaxSubscribers = 4;
+}  // namespace
+
+AudioSource::AudioSource() {
+  subscribers_.reserve(kMaxSubscribers);
+}
+
+uint32_t AudioSource::Subscribe(Subscriber&& subscriber) {
+  std::lock_guard lock(mutex_);
+  const auto id = next_id_++;
+  subscribers_.emplace_back(id, std::move(subscriber));
+  return id;
+}
+
+void AudioSource::Unsubscribe(const uint32_t id) {
+  std::lock_guard lock(mutex_);
+  for (auto it = subscribers_.begin(); it != subscribers_.end(); ++it) {
+    if (it->first == id) {
+      subscribers_.erase(it);
+      break;
+    }
+  }
+}
+
+void AudioSource::Publish(const int16_t* pcm, const int16_t* reference, const size_t samples) {
+  std::lock_guard lock(mutex_);
+  for (const auto& [id, subscriber] : subscribers_) {
+    subscriber(pcm, reference, samples);
+  }
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+#pragma once
+
+#ifndef _AUDIO_SOURCE_H_
+#define _AUDIO_SOURCE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// A mono PCM stream several consumers tap. Subscribers run on the producing task, buffers are only valid during the call.
+// |reference| is the aligned playback signal, nullptr without one.
+class AudioSource {
+ public:
+  using Subscriber = std::function<void(const int16_t* pcm, const int16_t* reference, const size_t samples)>;
+
+  static constexpr uint32_t kSampleRate = 16000;
+
+  virtual ~AudioSource() = default;
+
+  uint32_t sample_rate() const {
+    return sample_rate_;
+  }
+
+  uint32_t Subscribe(Subscriber&& subscriber);
+  // Once this returns the subscriber is no longer called.
+  void Unsubscribe(const uint32_t id);
+
+ protected:
+  AudioSource();
+  void Publish(const int16_t* pcm, const int16_t* reference, const size_t samples);
+
+  uint32_t sample_rate_ = kSampleRate;
+
+ private:
+  AudioSource(const AudioSource&) = delete;
+  AudioSource& operator=(const AudioSource&) = delete;
+
+  std::mutex mutex_;
+  std::vector<std::pair<uint32_t, Subscriber>> subscribers_;
+  uint32_t next_id_ = 0;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,15 @@
+#include "boot_timeline.h"
+
+#include <esp_timer.h>
+
+#ifndef CLOGGER_SEVERITY
+#define CLOGGER_SEVERITY CLOGGER_SEVERITY_WARN
+#endif
+#include "clogger/clogger.h"
+
+void BootTimeline::Add(std::string stage, const int64_t start_us, const bool ok) {
+  const auto end_us = esp_timer_get_time();
+  CLOGI("%s: %lld -> %lld ms%s", stage.c_str(), start_us / 1000, end_us / 1000, ok ? "" : ", failed");
+  std::lock_guard lock(mutex_);
+  stages_.push_back({std::move(stage), start_us, end_us, ok});
+}
\ No newline at end of file
@@ -0,0 +1,33 @@
+#pragma once
+
+#ifndef _BOOT_TIMELINE_H_
+#define _BOOT_TIMELINE_H_
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ai_vox_observer.h"
+
+// The stages of the engine start, recorded from the tasks that run them. Thread-safe.
+class BootTimeline {
+ public:
+  BootTimeline() = default;
+
+  // Adds |stage|, started at |start_us| since power-on and ended now.
+  void Add(std::string stage, const int64_t start_us, const bool ok = true);
+
+  std::vector<ai_vox::Observer::BootStage> stages() const {
+    std::lock_guard lock(mutex_);
+    return stages_;
+  }
+
+ private:
+  BootTimeline(const BootTimeline&) = delete;
+  BootTimeline& operator=(const BootTimeline&) = delete;
+
+  mutable std::mutex mutex_;
+  std::vector<ai_vox::Observer::BootStage> stages_;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,111 @@
+#pragma once
+
+#ifndef _BUFFER_POOL_H_
+#define _BUFFER_POOL_H_
+
+#include <freertos/FreeRTOS.h>
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+// Equally sized slabs allocated once. Acquire() and Release() never touch the heap, a miss returns nullptr and is counted.
+class BufferPool {
+ public:
+  BufferPool(const size_t slab_size, const size_t slab_count)
+      : slab_size_(Align(slab_size)),
+        slab_count_(slab_count),
+        storage_(reinterpret_cast<uint8_t*>(std::malloc(slab_size_ * slab_count_))),
+        free_slabs_(reinterpret_cast<uint16_t*>(std::malloc(slab_count_ * sizeof(uint16_t)))),
+        free_count_(slab_count_),
+        min_free_count_(slab_count_) {
+    assert(storage_ != nullptr && free_slabs_ != nullptr && slab_count_ <= UINT16_MAX);
+    if (storage_ == nullptr || free_slabs_ == nullptr || slab_count_ > UINT16_MAX) {
+      abort();
+    }
+
+    for (size_t i = 0; i < slab_count_; ++i) {
+      free_slabs_[i] = static_cast<uint16_t>(slab_count_ - 1 - i);
+    }
+  }
+
+  ~BufferPool() {
+    assert(free_count_ == slab_count_);
+    std::free(free_slabs_);
+    std::free(storage_);
+  }
+
+  // Returns a slab of slab_size() bytes, or nullptr when |size| bytes do not fit into a slab or no slab is free.
+  void* Acquire(const size_t size) {
+    if (size > slab_size_) {
+      miss_count_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+
+    uint8_t* slab = nullptr;
+    portENTER_CRITICAL(&lock_);
+    if (free_count_ > 0) {
+      slab = storage_ + free_slabs_[--free_count_] * slab_size_;
+      if (free_count_ < min_free_count_) {
+        min_free_count_ = free_count_;
+      }
+    }
+    portEXIT_CRITICAL(&lock_);
+
+    if (slab == nullptr) {
+      miss_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return slab;
+  }
+
+  void Release(void* slab) {
+    const auto index = (reinterpret_cast<uint8_t*>(slab) - storage_) / slab_size_;
+    assert(Owns(slab));
+    portENTER_CRITICAL(&lock_);
+    free_slabs_[free_count_++] = static_cast<uint16_t>(index);
+    portEXIT_CRITICAL(&lock_);
+  }
+
+  bool Owns(const void* slab) const {
+    return slab >= storage_ && slab < storage_ + slab_size_ * slab_count_;
+  }
+
+  size_t slab_size() const {
+    return slab_size_;
+  }
+
+  size_t slab_count() const {
+    return slab_count_;
+  }
+
+  // Lowest number of free slabs seen since construction.
+  size_t min_free_count() const {
+    return min_free_count_;
+  }
+
+  // Number of Acquire() calls that could not be served from the pool.
+  uint32_t miss_count() const {
+    return miss_count_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+
+  static constexpr size_t Align(const size_t size) {
+    return (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+  }
+
+  const size_t slab_size_ = 0;
+  const size_t slab_count_ = 0;
+  uint8_t* const storage_ = nullptr;
+  uint16_t* const free_slabs_ = nullptr;
+  size_t free_count_ = 0;
+  size_t min_free_count_ = 0;
+  std::atomic<uint32_t> miss_count_ = 0;
+  portMUX_TYPE lock_ = portMUX_INITIALIZER_UNLOCKED;
+};
+
+#endif
\ No newline at end of file
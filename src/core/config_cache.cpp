@@ -0,0 +1,91 @@
+#include "config_cache.h"
+
+#include <nvs.h>
+
+#include <ctime>
+#include <string>
+
+#ifndef CLOGGER_SEVERITY
+#define CLOGGER_SEVERITY CLOGGER_SEVERITY_WARN
+#endif
+#include "clogger/clogger.h"
+
+namespace {
+constexpr char kNvsNamespace[] = "ota_config";
+constexpr char kFetchTimeKey[] = "fetched_at";
+constexpr time_t kValidTime = 1704067200;  // 2024-01-01, earlier the clock has not been set
+
+bool GetString(nvs_handle_t handle, const char* key, std::string& value) {
+  size_t size = 0;
+  if (nvs_get_str(handle, key, nullptr, &size) != ESP_OK || size == 0) {
+    return false;
+  }
+  value.resize(size);
+  if (nvs_get_str(handle, key, value.data(), &size) != ESP_OK) {
+    return false;
+  }
+  value.resize(size - 1);
+  return true;
+}
+}  // namespace
+
+std::optional<Config> LoadCachedConfig(const uint32_t ttl_sec) {
+  nvs_handle_t handle = 0;
+  if (nvs_open(kNvsNamespace, NVS_READONLY, &handle) != ESP_OK) {
+    return std::nullopt;
+  }
+
+  Config config;
+  uint64_t fetch_time = 0;
+  const auto found = nvs_get_u64(handle, kFetchTimeKey, &fetch_time) == ESP_OK && GetString(handle, "endpoint", config.mqtt.endpoint) &&
+                     GetString(handle, "client_id", config.mqtt.client_id) && GetString(handle, "username", config.mqtt.username) &&
+                     GetString(handle, "password", config.mqtt.password) && GetString(handle, "pub_topic", config.mqtt.publish_topic) &&
+                     GetString(handle, "sub_topic", config.mqtt.subscribe_topic);
+  nvs_close(handle);
+  if (!found) {
+    return std::nullopt;
+  }
+
+  const auto now = time(nullptr);
+  if (now >= kValidTime && fetch_time >= static_cast<uint64_t>(kValidTime) &&
+      static_cast<uint64_t>(now) > fetch_time + static_cast<uint64_t>(ttl_sec)) {
+    CLOGI("cached config expired, fetched %llu s ago", static_cast<unsigned long long>(now - fetch_time));
+    return std::nullopt;
+  }
+  return config;
+}
+
+void SaveCachedConfig(const Config& config) {
+  nvs_handle_t handle = 0;
+  if (nvs_open(kNvsNamespace, NVS_READWRITE, &handle) != ESP_OK) {
+    CLOGW("nvs_open failed");
+    return;
+  }
+
+  // Stamped 0 while the clock is not set, such a cache never expires and is refreshed on every boot.
+  const auto now = time(nullptr);
+  const uint64_t fetch_time = now >= kValidTime ? now : 0;
+  // The time is erased first and written last: a save interrupted halfway leaves no cache rather than a mix of two configs.
+  nvs_erase_key(handle, kFetchTimeKey);
+  const auto ok = nvs_set_str(handle, "endpoint", config.mqtt.endpoint.c_str()) == ESP_OK &&
+                  nvs_set_str(handle, "client_id", config.mqtt.client_id.c_str()) == ESP_OK &&
+                  nvs_set_str(handle, "username", config.mqtt.username.c_str()) == ESP_OK &&
+                  nvs_set_str(handle, "password", config.mqtt.password.c_str()) == ESP_OK &&
+                  nvs_set_str(handle, "pub_topic", config.mqtt.publish_topic.c_str()) == ESP_OK &&
+                  nvs_set_str(handle, "sub_topic", config.mqtt.subscribe_topic.c_str()) == ESP_OK &&
+                  nvs_set_u64(handle, kFetchTimeKey, fetch_time) == ESP_OK && nvs_commit(handle) == ESP_OK;
+  if (!ok) {
+    CLOGW("saving config failed");
+  }
+  nvs_close(handle);
+}
+
+void EraseCachedConfig() {
+  nvs_handle_t handle = 0;
+  if (nvs_open(kNvsNamespace, NVS_READWRITE, &handle) != ESP_OK) {
+    return;
+  }
+  nvs_erase_all(handle);
+  nvs_commit(handle);
+  nvs_close(handle);
+}
\ No newline at end of file
@@ -0,0 +1,16 @@
+#pragma once
+
+#ifndef _CONFIG_CACHE_H_
+#define _CONFIG_CACHE_H_
+
+#include <cstdint>
+#include <optional>
+
+#include "fetch_config.h"
+
+// The last config without an activation code, in NVS. Older than |ttl_sec| it is not returned, unless the clock is not set yet.
+std::optional<Config> LoadCachedConfig(const uint32_t ttl_sec);
+void SaveCachedConfig(const Config& config);
+void EraseCachedConfig();
+
+#endif
\ No newline at end of file
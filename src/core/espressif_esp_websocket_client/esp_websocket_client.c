@@ -20,7 +20,10 @@
 #include "esp_timer.h"
 #include "esp_tls_crypto.h"
 #include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_random.h"
 #include <errno.h>
+#include <stdatomic.h>
 #include <arpa/inet.h>
 
 #define CONFIG_ESP_WS_CLIENT_ENABLE_DYNAMIC_BUFFER
@@ -103,6 +106,11 @@ typedef struct {
     const char                  *cert_common_name;
     esp_err_t                   (*crt_bundle_attach)(void *conf);
     esp_transport_handle_t      ext_transport;
+    esp_transport_handle_t      (*tls_transport_init)(void *arg);
+    void                        *tls_transport_arg;
+    bool                        persistent_buffers;
+    uint32_t                    buffer_caps;
+    size_t                      buffer_alignment;
 } websocket_config_storage_t;
 
 typedef enum {
@@ -137,6 +145,8 @@ struct esp_websocket_client {
     char                        *rx_buffer;
     char                        *tx_buffer;
     int                         buffer_size;
+    atomic_size_t               buffer_bytes;
+    atomic_size_t               buffer_high_water;
     bool                        last_fin;
     ws_transport_opcodes_t      last_opcode;
     int                         payload_len;
@@ -150,24 +160,50 @@ static uint64_t _tick_get_ms(void)
     return esp_timer_get_time() / 1000;
 }
 
-static esp_err_t esp_websocket_new_buf(esp_websocket_client_handle_t client, bool is_tx)
+static char *esp_websocket_alloc_buf(esp_websocket_client_handle_t client)
 {
-#ifdef CONFIG_ESP_WS_CLIENT_ENABLE_DYNAMIC_BUFFER
-    if (is_tx) {
-        if (client->tx_buffer) {
-            free(client->tx_buffer);
-        }
+    const websocket_config_storage_t *cfg = client->config;
+    const uint32_t caps = cfg->buffer_caps ? cfg->buffer_caps : MALLOC_CAP_DEFAULT;
+    char *buffer = cfg->buffer_alignment ? heap_caps_aligned_alloc(cfg->buffer_alignment, client->buffer_size, caps)
+                                         : heap_caps_malloc(client->buffer_size, caps);
+    if (buffer == NULL && caps != MALLOC_CAP_DEFAULT) {
+        ESP_LOGW(TAG, "No memory with caps 0x%" PRIx32 " for a buffer, using the default heap", caps);
+        buffer = cfg->buffer_alignment ? heap_caps_aligned_alloc(cfg->buffer_alignment, client->buffer_size, MALLOC_CAP_DEFAULT)
+                                       : heap_caps_malloc(client->buffer_size, MALLOC_CAP_DEFAULT);
+    }
+    if (buffer == NULL) {
+        return NULL;
+    }
 
-        client->tx_buffer = calloc(1, client->buffer_size);
-        ESP_WS_CLIENT_MEM_CHECK(TAG, client->tx_buffer, return ESP_ERR_NO_MEM);
-    } else {
-        if (client->rx_buffer) {
-            free(client->rx_buffer);
-        }
+    // The RX buffer is allocated on the client task and the TX one by senders, under the lock.
+    const size_t bytes = atomic_fetch_add(&client->buffer_bytes, client->buffer_size) + client->buffer_size;
+    size_t high_water = atomic_load(&client->buffer_high_water);
+    while (bytes > high_water && !atomic_compare_exchange_weak(&client->buffer_high_water, &high_water, bytes)) {
+    }
+    return buffer;
+}
 
-        client->rx_buffer = calloc(1, client->buffer_size);
-        ESP_WS_CLIENT_MEM_CHECK(TAG, client->rx_buffer, return ESP_ERR_NO_MEM);
+static void esp_websocket_release_buf(esp_websocket_client_handle_t client, char **buffer)
+{
+    if (*buffer) {
+        heap_caps_free(*buffer);
+        *buffer = NULL;
+        atomic_fetch_sub(&client->buffer_bytes, client->buffer_size);
     }
+}
+
+static esp_err_t esp_websocket_new_buf(esp_websocket_client_handle_t client, bool is_tx)
+{
+#ifdef CONFIG_ESP_WS_CLIENT_ENABLE_DYNAMIC_BUFFER
+    char **buffer = is_tx ? &client->tx_buffer : &client->rx_buffer;
+    if (client->config->persistent_buffers && *buffer) {
+        return ESP_OK;
+    }
+
+    // Not zeroed: received data and sent payloads are written over it before it is read.
+    esp_websocket_release_buf(client, buffer);
+    *buffer = esp_websocket_alloc_buf(client);
+    ESP_WS_CLIENT_MEM_CHECK(TAG, *buffer, return ESP_ERR_NO_MEM);
 #endif
     return ESP_OK;
 }
@@ -175,17 +211,10 @@ static esp_err_t esp_websocket_new_buf(esp_websocket_client_handle_t client, boo
 static void esp_websocket_free_buf(esp_websocket_client_handle_t client, bool is_tx)
 {
 #ifdef CONFIG_ESP_WS_CLIENT_ENABLE_DYNAMIC_BUFFER
-    if (is_tx) {
-        if (client->tx_buffer) {
-            free(client->tx_buffer);
-            client->tx_buffer = NULL;
-        }
-    } else {
-        if (client->rx_buffer) {
-            free(client->rx_buffer);
-            client->rx_buffer = NULL;
-        }
+    if (client->config->persistent_buffers) {
+        return;
     }
+    esp_websocket_release_buf(client, is_tx ? &client->tx_buffer : &client->rx_buffer);
 #endif
 }
 
@@ -400,6 +429,10 @@ static esp_err_t esp_websocket_client_set_config(esp_websocket_client_handle_t c
         cfg->ping_interval_sec = config->ping_interval_sec;
     }
 
+    cfg->persistent_buffers = config->persistent_buffers;
+    cfg->buffer_caps = config->buffer_caps;
+    cfg->buffer_alignment = config->buffer_alignment;
+
     return ESP_OK;
 }
 
@@ -441,8 +474,8 @@ static void destroy_and_free_resources(esp_websocket_client_handle_t client)
         esp_transport_list_destroy(client->transport_list);
     }
     vSemaphoreDelete(client->lock);
-    free(client->tx_buffer);
-    free(client->rx_buffer);
+    esp_websocket_release_buf(client, &client->tx_buffer);
+    esp_websocket_release_buf(client, &client->rx_buffer);
     free(client->errormsg_buffer);
     if (client->status_bits) {
         vEventGroupDelete(client->status_bits);
@@ -517,61 +550,64 @@ static esp_err_t esp_websocket_client_create_transport(esp_websocket_client_hand
         esp_transport_list_add(client->transport_list, ws, WS_OVER_TCP_SCHEME);
         ESP_WS_CLIENT_ERR_OK_CHECK(TAG, set_websocket_transport_optional_settings(client, WS_OVER_TCP_SCHEME), return ESP_FAIL;)
     } else if (strcasecmp(client->config->scheme, WS_OVER_TLS_SCHEME) == 0) {
-        esp_transport_handle_t ssl = esp_transport_ssl_init();
+        esp_transport_handle_t ssl = client->config->tls_transport_init ? client->config->tls_transport_init(client->config->tls_transport_arg)
+                                     : esp_transport_ssl_init();
         ESP_WS_CLIENT_MEM_CHECK(TAG, ssl, return ESP_ERR_NO_MEM);
 
         esp_transport_set_default_port(ssl, WEBSOCKET_SSL_DEFAULT_PORT);
         esp_transport_list_add(client->transport_list, ssl, "_ssl"); // need to save to transport list, for cleanup
-        if (client->keep_alive_cfg.keep_alive_enable) {
-            esp_transport_ssl_set_keep_alive(ssl, &client->keep_alive_cfg);
-        }
-        if (client->if_name) {
-            esp_transport_ssl_set_interface_name(ssl, client->if_name);
-        }
-
-        if (client->config->use_global_ca_store == true) {
-            esp_transport_ssl_enable_global_ca_store(ssl);
-        } else if (client->config->cert) {
-            if (!client->config->cert_len) {
-                esp_transport_ssl_set_cert_data(ssl, client->config->cert, strlen(client->config->cert));
-            } else {
-                esp_transport_ssl_set_cert_data_der(ssl, client->config->cert, client->config->cert_len);
+        if (!client->config->tls_transport_init) {
+            if (client->keep_alive_cfg.keep_alive_enable) {
+                esp_transport_ssl_set_keep_alive(ssl, &client->keep_alive_cfg);
             }
-        }
-        if (client->config->client_cert) {
-            if (!client->config->client_cert_len) {
-                esp_transport_ssl_set_client_cert_data(ssl, client->config->client_cert, strlen(client->config->client_cert));
-            } else {
-                esp_transport_ssl_set_client_cert_data_der(ssl, client->config->client_cert, client->config->client_cert_len);
+            if (client->if_name) {
+                esp_transport_ssl_set_interface_name(ssl, client->if_name);
             }
-        }
-        if (client->config->client_key) {
-            if (!client->config->client_key_len) {
-                esp_transport_ssl_set_client_key_data(ssl, client->config->client_key, strlen(client->config->client_key));
-            } else {
-                esp_transport_ssl_set_client_key_data_der(ssl, client->config->client_key, client->config->client_key_len);
+
+            if (client->config->use_global_ca_store == true) {
+                esp_transport_ssl_enable_global_ca_store(ssl);
+            } else if (client->config->cert) {
+                if (!client->config->cert_len) {
+                    esp_transport_ssl_set_cert_data(ssl, client->config->cert, strlen(client->config->cert));
+                } else {
+                    esp_transport_ssl_set_cert_data_der(ssl, client->config->cert, client->config->cert_len);
+                }
+            }
+            if (client->config->client_cert) {
+                if (!client->config->client_cert_len) {
+                    esp_transport_ssl_set_client_cert_data(ssl, client->config->client_cert, strlen(client->config->client_cert));
+                } else {
+                    esp_transport_ssl_set_client_cert_data_der(ssl, client->config->client_cert, client->config->client_cert_len);
+                }
             }
+            if (client->config->client_key) {
+                if (!client->config->client_key_len) {
+                    esp_transport_ssl_set_client_key_data(ssl, client->config->client_key, strlen(client->config->client_key));
+                } else {
+                    esp_transport_ssl_set_client_key_data_der(ssl, client->config->client_key, client->config->client_key_len);
+                }
 #if CONFIG_ESP_TLS_USE_DS_PERIPHERAL
-        } else if (client->config->client_ds_data) {
-            esp_transport_ssl_set_ds_data(ssl, client->config->client_ds_data);
+            } else if (client->config->client_ds_data) {
+                esp_transport_ssl_set_ds_data(ssl, client->config->client_ds_data);
 #endif
-        }
-        if (client->config->crt_bundle_attach) {
+            }
+            if (client->config->crt_bundle_attach) {
 #ifdef CONFIG_MBEDTLS_CERTIFICATE_BUNDLE
-            esp_transport_ssl_crt_bundle_attach(ssl, client->config->crt_bundle_attach);
+                esp_transport_ssl_crt_bundle_attach(ssl, client->config->crt_bundle_attach);
 #else //CONFIG_MBEDTLS_CERTIFICATE_BUNDLE
-            ESP_LOGE(TAG, "crt_bundle_attach configured but not enabled in menuconfig: Please enable MBEDTLS_CERTIFICATE_BUNDLE option");
+                ESP_LOGE(TAG, "crt_bundle_attach configured but not enabled in menuconfig: Please enable MBEDTLS_CERTIFICATE_BUNDLE option");
 #endif
-        }
-        if (client->config->skip_cert_common_name_check) {
-            esp_transport_ssl_skip_common_name_check(ssl);
-        }
-        if (client->config->cert_common_name) {
+            }
+            if (client->config->skip_cert_common_name_check) {
+                esp_transport_ssl_skip_common_name_check(ssl);
+            }
+            if (client->config->cert_common_name) {
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
-            esp_transport_ssl_set_common_name(ssl, client->config->cert_common_name);
+                esp_transport_ssl_set_common_name(ssl, client->config->cert_common_name);
 #else
-            ESP_LOGE(TAG, "cert_common_name requires ESP-IDF 5.1.0 or later");
+                ESP_LOGE(TAG, "cert_common_name requires ESP-IDF 5.1.0 or later");
 #endif
+            }
         }
 
         esp_transport_handle_t wss = esp_transport_ws_init(ssl);
@@ -727,6 +763,8 @@ esp_websocket_client_handle_t esp_websocket_client_init(const esp_websocket_clie
     client->config->cert_common_name = config->cert_common_name;
     client->config->crt_bundle_attach = config->crt_bundle_attach;
     client->config->ext_transport = config->ext_transport;
+    client->config->tls_transport_init = config->tls_transport_init;
+    client->config->tls_transport_arg = config->tls_transport_arg;
 
     if (config->uri) {
         if (esp_websocket_client_set_uri(client, config->uri) != ESP_OK) {
@@ -757,12 +795,13 @@ esp_websocket_client_handle_t esp_websocket_client_init(const esp_websocket_clie
     }
     client->errormsg_buffer = NULL;
     client->errormsg_size = 0;
+    client->buffer_size = buffer_size;
 #ifndef CONFIG_ESP_WS_CLIENT_ENABLE_DYNAMIC_BUFFER
-    client->rx_buffer = malloc(buffer_size);
+    client->rx_buffer = esp_websocket_alloc_buf(client);
     ESP_WS_CLIENT_MEM_CHECK(TAG, client->rx_buffer, {
         goto _websocket_init_fail;
     });
-    client->tx_buffer = malloc(buffer_size);
+    client->tx_buffer = esp_websocket_alloc_buf(client);
     ESP_WS_CLIENT_MEM_CHECK(TAG, client->tx_buffer, {
         goto _websocket_init_fail;
     });
@@ -773,7 +812,6 @@ esp_websocket_client_handle_t esp_websocket_client_init(const esp_websocket_clie
     });
     xEventGroupSetBits(client->status_bits, STOPPED_BIT);
 
-    client->buffer_size = buffer_size;
     return client;
 
 _websocket_init_fail:
@@ -1273,6 +1311,78 @@ int esp_websocket_client_send_bin(esp_websocket_client_handle_t client, const ch
     return esp_websocket_client_send_with_opcode(client, WS_TRANSPORT_OPCODES_BINARY, (const uint8_t *)data, len, timeout);
 }
 
+int esp_websocket_client_send_bin_in_place(esp_websocket_client_handle_t client, uint8_t *buffer, int len, TickType_t timeout)
+{
+    int ret = -1;
+
+    if (client == NULL || len < 0 || buffer == NULL) {
+        ESP_LOGE(TAG, "Invalid arguments");
+        return -1;
+    }
+
+    if (client->config->ext_transport) {
+        return esp_websocket_client_send_bin(client, (const char *)buffer + ESP_WEBSOCKET_SEND_HEADROOM, len, timeout);
+    }
+
+    if (!esp_websocket_client_is_connected(client)) {
+        ESP_LOGE(TAG, "Websocket client is not connected");
+        return -1;
+    }
+
+    // The websocket transport writes the header and the payload separately, the frame is built here for the transport below it.
+    const bool tls = strcasecmp(client->config->scheme, WS_OVER_TLS_SCHEME) == 0;
+    esp_transport_handle_t parent = esp_transport_list_get_transport(client->transport_list, tls ? "_ssl" : "_tcp");
+    if (parent == NULL) {
+        ESP_LOGE(TAG, "Invalid transport");
+        return -1;
+    }
+
+    const int length_bytes = len < 126 ? 0 : (len <= 0xFFFF ? 2 : 8);
+    const int header_len = 2 + length_bytes + 4;
+    uint8_t *frame = buffer + ESP_WEBSOCKET_SEND_HEADROOM - header_len;
+    uint8_t *payload = buffer + ESP_WEBSOCKET_SEND_HEADROOM;
+    frame[0] = WS_TRANSPORT_OPCODES_BINARY | WS_TRANSPORT_OPCODES_FIN;
+    frame[1] = 0x80 | (length_bytes == 0 ? len : (length_bytes == 2 ? 126 : 127));
+    for (int i = 0; i < length_bytes; ++i) {
+        frame[2 + i] = (uint8_t)((uint64_t)len >> (8 * (length_bytes - 1 - i)));
+    }
+    uint8_t *mask = frame + 2 + length_bytes;
+    esp_fill_random(mask, 4);
+    for (int i = 0; i < len; ++i) {
+        payload[i] ^= mask[i % 4];
+    }
+
+    if (xSemaphoreTakeRecursive(client->lock, timeout) != pdPASS) {
+        ESP_LOGE(TAG, "Could not lock ws-client within %" PRIu32 " timeout", timeout);
+        return -1;
+    }
+
+    const int total = header_len + len;
+    int widx = 0;
+    while (widx < total) {
+        const int wlen = esp_transport_write(parent, (const char *)frame + widx, total - widx,
+                                             (timeout == portMAX_DELAY) ? -1 : timeout * portTICK_PERIOD_MS);
+        if (wlen <= 0) {
+            esp_tls_error_handle_t error_handle = esp_transport_get_error_handle(client->transport);
+            if (error_handle) {
+                esp_websocket_client_error(client, "esp_transport_write() returned %d, transport_error=%s, tls_error_code=%i, tls_flags=%i, errno=%d",
+                                           wlen, esp_err_to_name(error_handle->last_error), error_handle->esp_tls_error_code,
+                                           error_handle->esp_tls_flags, errno);
+            } else {
+                esp_websocket_client_error(client, "esp_transport_write() returned %d, errno=%d", wlen, errno);
+            }
+            esp_websocket_client_abort_connection(client, WEBSOCKET_ERROR_TYPE_TCP_TRANSPORT);
+            goto unlock_and_return;
+        }
+        widx += wlen;
+    }
+    ret = len;
+
+unlock_and_return:
+    xSemaphoreGiveRecursive(client->lock);
+    return ret;
+}
+
 int esp_websocket_client_send_bin_partial(esp_websocket_client_handle_t client, const char *data, int len, TickType_t timeout)
 {
     return esp_websocket_client_send_with_exact_opcode(client, WS_TRANSPORT_OPCODES_BINARY, (const uint8_t *)data, len, timeout);
@@ -1296,6 +1406,16 @@ bool esp_websocket_client_is_connected(esp_websocket_client_handle_t client)
     return client->state == WEBSOCKET_STATE_CONNECTED;
 }
 
+size_t esp_websocket_client_get_buffer_high_water(esp_websocket_client_handle_t client)
+{
+    if (client == NULL) {
+        ESP_LOGW(TAG, "Client was not initialized");
+        return 0;
+    }
+
+    return atomic_load(&client->buffer_high_water);
+}
+
 size_t esp_websocket_client_get_ping_interval_sec(esp_websocket_client_handle_t client)
 {
     if (client == NULL) {
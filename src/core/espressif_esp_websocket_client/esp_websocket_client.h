@@ -106,6 +106,9 @@ typedef struct {
     const char                 *task_name;                  /*!< Websocket task name */
     int                         task_stack;                 /*!< Websocket task stack */
     int                         buffer_size;                /*!< Websocket buffer size */
+    bool                        persistent_buffers;         /*!< Keep the RX and TX buffers allocated for the lifetime of the client */
+    uint32_t                    buffer_caps;                /*!< Heap capabilities of the RX and TX buffers, 0 for the default heap */
+    size_t                      buffer_alignment;           /*!< Alignment of the RX and TX buffers, 0 for the default */
     const char                  *cert_pem;                  /*!< Pointer to certificate data in PEM or DER format for server verify (with SSL), default is NULL, not required to verify the server. PEM-format must have a terminating NULL-character. DER-format requires the length to be passed in cert_len. */
     size_t                      cert_len;                   /*!< Length of the buffer pointed to by cert_pem. May be 0 for null-terminated pem */
     const char                  *client_cert;               /*!< Pointer to certificate data in PEM or DER format for SSL mutual authentication, default is NULL, not required if mutual authentication is not needed. If it is not NULL, also `client_key` or `client_ds_data` (if supported) has to be provided. PEM-format must have a terminating NULL-character. DER-format requires the length to be passed in client_cert_len. */
@@ -134,6 +137,8 @@ typedef struct {
     size_t                      ping_interval_sec;          /*!< Websocket ping interval, defaults to 10 seconds if not set */
     struct ifreq                *if_name;                   /*!< The name of interface for data to go through. Use the default interface without setting */
     esp_transport_handle_t      ext_transport;              /*!< External WebSocket tcp_transport handle to the client; or if null, the client will create its own transport handle. */
+    esp_transport_handle_t      (*tls_transport_init)(void *arg); /*!< Creates the wss transport instead of esp_transport_ssl, owned by the transport list */
+    void                        *tls_transport_arg;         /*!< Argument passed to tls_transport_init */
 } esp_websocket_client_config_t;
 
 /**
@@ -256,6 +261,28 @@ esp_err_t esp_websocket_client_destroy_on_exit(esp_websocket_client_handle_t cli
  */
 int esp_websocket_client_send_bin(esp_websocket_client_handle_t client, const char *data, int len, TickType_t timeout);
 
+/**
+ * @brief Bytes to reserve in front of the payload passed to esp_websocket_client_send_bin_in_place(), the largest header of a
+ *        masked client frame.
+ */
+#define ESP_WEBSOCKET_SEND_HEADROOM (14)
+
+/**
+ * @brief      Write binary data to the WebSocket connection as a single frame, without copying it
+ *
+ * The header is written into the headroom and the payload masked in place, the content of the buffer is lost.
+ *
+ * @param[in]  client  The client
+ * @param[in]  buffer  ESP_WEBSOCKET_SEND_HEADROOM bytes of headroom followed by the payload, writable
+ * @param[in]  len     The length of the payload
+ * @param[in]  timeout Write data timeout in RTOS ticks
+ *
+ * @return
+ *     - Number of payload bytes sent
+ *     - (-1) if any errors
+ */
+int esp_websocket_client_send_bin_in_place(esp_websocket_client_handle_t client, uint8_t *buffer, int len, TickType_t timeout);
+
 /**
  * @brief      Write binary data to the WebSocket connection and sends it without setting the FIN flag(data send with WS OPCODE=02, i.e. binary)
  *
@@ -404,6 +431,15 @@ esp_err_t esp_websocket_client_close_with_code(esp_websocket_client_handle_t cli
  */
 bool esp_websocket_client_is_connected(esp_websocket_client_handle_t client);
 
+/**
+ * @brief      Get the largest amount of memory held at once by the RX and TX buffers of the client.
+ *
+ * @param[in]  client             The client
+ *
+ * @return     The high-water mark in bytes
+ */
+size_t esp_websocket_client_get_buffer_high_water(esp_websocket_client_handle_t client);
+
 /**
  * @brief      Get the ping interval sec for client.
  *
@@ -0,0 +1,278 @@
+#include "executor.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#ifndef CLOGGER_SEVERITY
+#define CLOGGER_SEVERITY CLOGGER_SEVERITY_WARN
+#endif
+#include "core/clogger/clogger.h"
+
+namespace {
+constexpr size_t kBatchSize = 8;  // tasks run before a strand yields its worker to the other ready strands of the pool
+constexpr UBaseType_t kMaxWakeUps = 64;
+}  // namespace
+
+Executor::Executor(const PoolConfig& audio, const PoolConfig& network) : exit_sem_(xSemaphoreCreateCounting(audio.workers + network.workers, 0)) {
+  CreatePool(audio_pool_, audio, "AudioWorker", kAudioCoreId);
+  CreatePool(network_pool_, network, "NetWorker", kNetworkCoreId);
+}
+
+Executor::~Executor() {
+  running_ = false;
+  size_t workers = 0;
+  for (auto* pool : {&audio_pool_, &network_pool_}) {
+    for (size_t i = 0; i < pool->workers.size(); ++i) {
+      xSemaphoreGive(pool->ready_sem);
+    }
+    workers += pool->workers.size();
+  }
+
+  for (size_t i = 0; i < workers; ++i) {
+    xSemaphoreTake(exit_sem_, portMAX_DELAY);
+  }
+
+  for (auto* pool : {&audio_pool_, &network_pool_}) {
+    for (auto& worker : pool->workers) {
+      vTaskDelete(worker->task_handle);
+      delete[] worker->stack_buffer;
+    }
+    vSemaphoreDelete(pool->ready_sem);
+  }
+  vSemaphoreDelete(exit_sem_);
+}
+
+void Executor::CreatePool(PoolState& pool, const PoolConfig& config, const char* name, const BaseType_t core_id) {
+  pool.config = config;
+  pool.ready_sem = xSemaphoreCreateCounting(kMaxWakeUps, 0);
+  pool.strands.reserve(4);
+  pool.ready.reserve(4);
+  for (size_t i = 0; i < config.workers; ++i) {
+    auto worker = std::make_unique<Worker>();
+    worker->executor = this;
+    worker->pool = &pool;
+    worker->stack_buffer = new StackType_t[config.stack_depth];
+    char task_name[configMAX_TASK_NAME_LEN] = {0};
+    snprintf(task_name, sizeof(task_name), "%s%zu", name, i);
+    worker->task_handle = xTaskCreateStaticPinnedToCore(
+        &Loop, task_name, config.stack_depth, worker.get(), config.priority, worker->stack_buffer, &worker->task_buffer, core_id);
+    assert(worker->task_handle != nullptr);
+    if (worker->task_handle == nullptr) {
+      CLOGE("failed to create %s", task_name);
+      abort();
+    }
+    pool.workers.push_back(std::move(worker));
+  }
+}
+
+Executor::PoolState& Executor::pool(const Pool pool) {
+  return pool == Pool::kAudio ? audio_pool_ : network_pool_;
+}
+
+void Executor::Register(Strand* strand) {
+  auto& pool = this->pool(strand->pool_);
+  std::lock_guard lock(pool.mutex);
+  assert(pool.strands.size() < kMaxStrands);
+  if (pool.strands.size() >= kMaxStrands) {
+    CLOGE("too many strands: %zu", pool.strands.size() + 1);
+    abort();
+  }
+  pool.strands.push_back(strand);
+}
+
+void Executor::Unregister(Strand* strand) {
+  auto& pool = this->pool(strand->pool_);
+  std::unique_lock lock(pool.mutex);
+  strand->closing_ = true;
+  pool.strands.erase(std::remove(pool.strands.begin(), pool.strands.end(), strand), pool.strands.end());
+  while (true) {
+    TakeScheduled(pool);
+    const auto it = std::find(pool.ready.begin(), pool.ready.end(), strand);
+    if (it != pool.ready.end()) {
+      pool.ready.erase(it);
+      strand->state_ = Strand::kIdle;
+    }
+    UpdateReadyPriority(pool);
+
+    const auto state = strand->state_.load();
+    if (state == Strand::kRunning || state == Strand::kRunningWoken) {
+      lock.unlock();
+      xSemaphoreTake(strand->idle_sem_, portMAX_DELAY);
+      // Given under the lock, taking it again makes sure the worker is done with the semaphore.
+      lock.lock();
+      return;
+    }
+    if (state != Strand::kScheduled) {
+      return;
+    }
+    // Still behind a strand being pushed to |scheduled| by another producer.
+    lock.unlock();
+    vTaskDelay(1);
+    lock.lock();
+  }
+}
+
+void Executor::Schedule(Strand* strand) {
+  auto& pool = this->pool(strand->pool_);
+  // Read before the push: from then on Unregister() may take the strand out and let it be destroyed.
+  const auto priority = strand->priority_;
+  // A strand is scheduled once until a worker takes it and a pool has no more strands than |scheduled| holds, the push succeeds.
+  auto* scheduled = strand;
+  const auto pushed = pool.scheduled.TryPush(scheduled);
+  assert(pushed);
+  if (!pushed) {
+    CLOGE("failed to schedule a strand");
+    abort();
+  }
+
+  auto ready_priority = pool.ready_priority.load(std::memory_order_relaxed);
+  while (ready_priority < priority && !pool.ready_priority.compare_exchange_weak(ready_priority, priority)) {
+  }
+  xSemaphoreGive(pool.ready_sem);
+}
+
+void Executor::TakeScheduled(PoolState& pool) {
+  Strand* strand = nullptr;
+  while (pool.scheduled.TryPop(strand)) {
+    if (strand->closing_) {
+      strand->state_ = Strand::kIdle;
+      continue;
+    }
+    pool.ready.push_back(strand);
+  }
+}
+
+void Executor::UpdateReadyPriority(PoolState& pool) {
+  UBaseType_t priority = 0;
+  for (const auto* strand : pool.ready) {
+    priority = std::max(priority, strand->priority_);
+  }
+  pool.ready_priority = priority;
+}
+
+void Executor::Loop(void* worker) {
+  auto* self = reinterpret_cast<Worker*>(worker);
+  self->executor->Loop(*self->pool);
+}
+
+void Executor::Loop(PoolState& pool) {
+  while (running_) {
+    Strand* strand = nullptr;
+    auto timeout = portMAX_DELAY;
+    {
+      std::lock_guard lock(pool.mutex);
+      TakeScheduled(pool);
+      const auto now = std::chrono::steady_clock::now();
+      for (auto* sleeping : pool.strands) {
+        if (sleeping->wake_time_ > now) {
+          timeout = std::min(timeout, SerialQueue::TicksUntil(sleeping->wake_time_, now));
+          continue;
+        }
+
+        sleeping->wake_time_ = SerialQueue::TimePoint::max();
+        // Strands already scheduled or running will run their delayed task anyway.
+        uint8_t expected = Strand::kIdle;
+        if (sleeping->state_.compare_exchange_strong(expected, Strand::kScheduled)) {
+          pool.ready.push_back(sleeping);
+          UpdateReadyPriority(pool);
+        }
+      }
+
+      // The highest priority first, in the order they became ready among equals.
+      auto it = std::max_element(
+          pool.ready.begin(), pool.ready.end(), [](const Strand* lhs, const Strand* rhs) { return lhs->priority_ < rhs->priority_; });
+      if (it != pool.ready.end()) {
+        strand = *it;
+        pool.ready.erase(it);
+        UpdateReadyPriority(pool);
+        strand->state_ = Strand::kRunning;
+        strand->wake_time_ = SerialQueue::TimePoint::max();
+      }
+    }
+
+    if (strand == nullptr) {
+      xSemaphoreTake(pool.ready_sem, timeout);
+      continue;
+    }
+
+    // Strands of a higher priority preempt this one through the other workers of the pool.
+    vTaskPrioritySet(nullptr, strand->priority_);
+    const auto more = strand->RunBatch(pool.ready_priority);
+    vTaskPrioritySet(nullptr, pool.config.priority);
+
+    bool wake_worker = false;
+    {
+      std::lock_guard lock(pool.mutex);
+      if (strand->closing_) {
+        strand->state_ = Strand::kIdle;
+        xSemaphoreGive(strand->idle_sem_);
+        continue;
+      }
+
+      uint8_t expected = Strand::kRunning;
+      if (more || !strand->state_.compare_exchange_strong(expected, Strand::kIdle)) {
+        strand->state_ = Strand::kScheduled;
+        TakeScheduled(pool);
+        pool.ready.push_back(strand);
+        UpdateReadyPriority(pool);
+        wake_worker = true;
+      } else {
+        // Lets an idle worker shorten its wait when the delayed task is due earlier than it planned.
+        strand->wake_time_ = strand->next_due_time();
+        wake_worker = strand->wake_time_ != SerialQueue::TimePoint::max();
+      }
+    }
+
+    if (wake_worker) {
+      xSemaphoreGive(pool.ready_sem);
+    }
+  }
+
+  xSemaphoreGive(exit_sem_);
+  vTaskDelay(portMAX_DELAY);
+}
+
+Strand::Strand(std::shared_ptr<Executor> executor,
+               const Executor::Pool pool,
+               const UBaseType_t priority,
+               const size_t capacity,
+               const OverflowPolicy overflow_policy)
+    : SerialQueue(capacity, overflow_policy),
+      executor_(std::move(executor)),
+      pool_(pool),
+      priority_(priority),
+      idle_sem_(xSemaphoreCreateBinary()) {
+  executor_->Register(this);
+}
+
+Strand::~Strand() {
+  executor_->Unregister(this);
+  vSemaphoreDelete(idle_sem_);
+}
+
+void Strand::Wake() {
+  auto state = state_.load();
+  while (true) {
+    if (state == kIdle) {
+      if (state_.compare_exchange_weak(state, kScheduled)) {
+        executor_->Schedule(this);
+        return;
+      }
+    } else if (state == kRunning) {
+      if (state_.compare_exchange_weak(state, kRunningWoken)) {
+        return;
+      }
+    } else {
+      return;
+    }
+  }
+}
+
+bool Strand::RunBatch(const std::atomic<UBaseType_t>& ready_priority) {
+  for (size_t i = 0; i < kBatchSize && ready_priority.load(std::memory_order_relaxed) <= priority_; ++i) {
+    if (!RunNext(std::chrono::steady_clock::now())) {
+      return false;
+    }
+  }
+  return true;
+}
\ No newline at end of file
@@ -0,0 +1,129 @@
+#pragma once
+
+#ifndef _EXECUTOR_H_
+#define _EXECUTOR_H_
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "core/mpmc_queue/mpmc_queue.h"
+#include "core/task_queue/serial_queue.h"
+
+class Strand;
+
+// Two fixed pools of workers, audio and network, each pinned to a core, that run Strands by priority.
+class Executor {
+ public:
+  enum class Pool : uint8_t {
+    kAudio,
+    kNetwork,
+  };
+
+  struct PoolConfig {
+    size_t workers;
+    uint32_t stack_depth;  // must fit the strands of the pool
+    UBaseType_t priority;  // of idle workers, a worker runs at the priority of the strand it serves
+  };
+
+  static constexpr size_t kMaxStrands = 16;  // per pool
+
+  static constexpr BaseType_t kNetworkCoreId = 0;
+  static constexpr BaseType_t kAudioCoreId = portNUM_PROCESSORS > 1 ? 1 : 0;
+
+  Executor(const PoolConfig& audio, const PoolConfig& network);
+  ~Executor();
+
+ private:
+  friend class Strand;
+
+  struct PoolState;
+
+  struct Worker {
+    Executor* executor = nullptr;
+    PoolState* pool = nullptr;
+    StackType_t* stack_buffer = nullptr;
+    StaticTask_t task_buffer;
+    TaskHandle_t task_handle = nullptr;
+  };
+
+  struct PoolState {
+    PoolConfig config;
+    std::mutex mutex;
+    std::vector<Strand*> strands;  // every strand of the pool, for their delayed tasks
+    std::vector<Strand*> ready;    // in the order they became ready
+    MpmcQueue<Strand*> scheduled{kMaxStrands};  // lock-free, strands scheduled by producers and not yet moved to |ready|
+    // The highest of |ready| and |scheduled|, a hint for a running batch to yield.
+    std::atomic<UBaseType_t> ready_priority = 0;
+    SemaphoreHandle_t ready_sem = nullptr;
+    std::vector<std::unique_ptr<Worker>> workers;
+  };
+
+  Executor(const Executor&) = delete;
+  Executor& operator=(const Executor&) = delete;
+
+  void CreatePool(PoolState& pool, const PoolConfig& config, const char* name, const BaseType_t core_id);
+  PoolState& pool(const Pool pool);
+  void Register(Strand* strand);
+  // Waits for the task of the strand running at the time, if any.
+  void Unregister(Strand* strand);
+  void Schedule(Strand* strand);
+  // Under the pool mutex, moves the strands scheduled since to |ready|, those being closed are dropped.
+  static void TakeScheduled(PoolState& pool);
+  static void UpdateReadyPriority(PoolState& pool);
+  static void Loop(void* worker);
+  void Loop(PoolState& pool);
+
+  PoolState audio_pool_;
+  PoolState network_pool_;
+  std::atomic<bool> running_ = true;
+  SemaphoreHandle_t exit_sem_ = nullptr;
+};
+
+// A serial queue run by an Executor pool. The destructor waits for the running task and discards the pending ones.
+class Strand : public SerialQueue {
+ public:
+  Strand(std::shared_ptr<Executor> executor,
+         const Executor::Pool pool,
+         const UBaseType_t priority,
+         const size_t capacity = 0,
+         const OverflowPolicy overflow_policy = OverflowPolicy::kDropNewest);
+  ~Strand();
+
+  UBaseType_t priority() const {
+    return priority_;
+  }
+
+ private:
+  friend class Executor;
+
+  enum State : uint8_t {
+    kIdle,
+    kScheduled,
+    kRunning,
+    kRunningWoken,  // a task was enqueued while running
+  };
+
+  Strand(const Strand&) = delete;
+  Strand& operator=(const Strand&) = delete;
+
+  void Wake() override;
+  // Runs up to a batch of tasks, fewer when a strand of a higher priority is ready. Returns false when nothing more is due.
+  bool RunBatch(const std::atomic<UBaseType_t>& ready_priority);
+
+  const std::shared_ptr<Executor> executor_;
+  const Executor::Pool pool_;
+  const UBaseType_t priority_;
+  std::atomic<uint8_t> state_ = kIdle;
+  SemaphoreHandle_t idle_sem_ = nullptr;
+  // Guarded by the pool mutex.
+  TimePoint wake_time_ = TimePoint::max();
+  bool closing_ = false;
+};
+
+#endif
\ No newline at end of file
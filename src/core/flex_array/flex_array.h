@@ -5,46 +5,120 @@
 
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <utility>
 
+#include "core/buffer_pool/buffer_pool.h"
+
 template <typename T>
 class FlexArray {
   static_assert(std::is_trivial_v<T>, "FlexArray supports only trivial types");
 
  public:
-  explicit FlexArray(const size_t size) noexcept : size_(size), buffer_(reinterpret_cast<T*>(std::malloc(size * sizeof(T)))) {
+  FlexArray() noexcept = default;
+
+  explicit FlexArray(const size_t size) noexcept
+      : size_(size), capacity_(size), buffer_(reinterpret_cast<T*>(std::malloc(size * sizeof(T)))) {
+  }
+
+  // A slab of |pool| when one fits, malloc otherwise.
+  FlexArray(BufferPool* pool, const size_t size) noexcept : size_(size) {
+    if (pool != nullptr && (buffer_ = reinterpret_cast<T*>(pool->Acquire(size * sizeof(T)))) != nullptr) {
+      pool_ = pool;
+      capacity_ = pool->slab_size() / sizeof(T);
+    } else {
+      buffer_ = reinterpret_cast<T*>(std::malloc(size * sizeof(T)));
+      capacity_ = size;
+    }
   }
 
-  FlexArray(FlexArray&& other) noexcept : size_(other.size_), buffer_(other.buffer_) {
+  FlexArray(FlexArray&& other) noexcept : size_(other.size_), capacity_(other.capacity_), buffer_(other.buffer_), pool_(other.pool_) {
     other.buffer_ = nullptr;
     other.size_ = 0;
+    other.capacity_ = 0;
+    other.pool_ = nullptr;
   }
 
   ~FlexArray() {
-    if (buffer_ != nullptr) {
-      std::free(buffer_);
+    Release();
+  }
+
+  FlexArray& operator=(FlexArray&& other) noexcept {
+    if (this != &other) {
+      Release();
+      size_ = std::exchange(other.size_, 0);
+      capacity_ = std::exchange(other.capacity_, 0);
+      buffer_ = std::exchange(other.buffer_, nullptr);
+      pool_ = std::exchange(other.pool_, nullptr);
     }
+    return *this;
   }
 
-  void Resize(const size_t size) noexcept {
-    buffer_ = reinterpret_cast<T*>(std::realloc(buffer_, size * sizeof(T)));
+  // Allocates only beyond the capacity, false and unchanged when out of memory.
+  bool Resize(const size_t size) noexcept {
+    if (size <= capacity_) {
+      size_ = size;
+      return true;
+    }
+
+    if (pool_ != nullptr) {
+      auto buffer = reinterpret_cast<T*>(std::malloc(size * sizeof(T)));
+      if (buffer == nullptr) {
+        return false;
+      }
+      std::memcpy(buffer, buffer_, size_ * sizeof(T));
+      pool_->Release(buffer_);
+      pool_ = nullptr;
+      buffer_ = buffer;
+    } else {
+      auto buffer = reinterpret_cast<T*>(std::realloc(buffer_, size * sizeof(T)));
+      if (buffer == nullptr) {
+        return false;
+      }
+      buffer_ = buffer;
+    }
     size_ = size;
+    capacity_ = size;
+    return true;
   }
 
   size_t size() const noexcept {
     return size_;
   }
 
+  size_t capacity() const noexcept {
+    return capacity_;
+  }
+
   T* data() const noexcept {
     return buffer_;
   }
 
+  BufferPool* pool() const noexcept {
+    return pool_;
+  }
+
  private:
   FlexArray(const FlexArray&) = delete;
   FlexArray& operator=(const FlexArray&) = delete;
 
+  void Release() noexcept {
+    if (buffer_ == nullptr) {
+      return;
+    }
+
+    if (pool_ != nullptr) {
+      pool_->Release(buffer_);
+    } else {
+      std::free(buffer_);
+    }
+    buffer_ = nullptr;
+  }
+
   size_t size_ = 0;
+  size_t capacity_ = 0;
   T* buffer_ = nullptr;
+  BufferPool* pool_ = nullptr;
 };
 
 #endif
\ No newline at end of file
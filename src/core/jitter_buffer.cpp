@@ -0,0 +1,170 @@
+#include "jitter_buffer.h"
+
+#include <esp_timer.h>
+
+#include <algorithm>
+
+#ifndef CLOGGER_SEVERITY
+#define CLOGGER_SEVERITY CLOGGER_SEVERITY_WARN
+#endif
+#include "clogger/clogger.h"
+
+namespace {
+constexpr size_t kMinTargetDepth = 1;        // frames
+constexpr uint32_t kMaxConcealedFrames = 3;  // consecutive, after that the stream is considered paused and buffers again
+constexpr int64_t kJitterDecay = 64;         // the lateness peak decays by 1/kJitterDecay per packet
+}  // namespace
+
+JitterBuffer::JitterBuffer(const uint32_t frame_duration, const size_t capacity, BufferPool* packet_pool)
+    : frame_duration_us_(static_cast<int64_t>(frame_duration) * 1000), packet_pool_(packet_pool), entries_(capacity) {
+}
+
+bool JitterBuffer::Push(FlexArray<uint8_t>&& packet) {
+  std::lock_guard lock(mutex_);
+  if (!open_) {
+    return false;
+  }
+  UpdateJitter();
+  Append(std::move(packet), false);
+  return true;
+}
+
+bool JitterBuffer::PushLost() {
+  std::lock_guard lock(mutex_);
+  if (!open_) {
+    return false;
+  }
+  UpdateJitter();
+  Append(FlexArray<uint8_t>(), true);
+  return true;
+}
+
+void JitterBuffer::End() {
+  std::lock_guard lock(mutex_);
+  ended_ = true;
+}
+
+void JitterBuffer::Open() {
+  std::lock_guard lock(mutex_);
+  if (!open_) {
+    open_ = true;
+    held_ = true;
+  }
+}
+
+void JitterBuffer::Play() {
+  std::lock_guard lock(mutex_);
+  held_ = false;
+}
+
+void JitterBuffer::Clear() {
+  std::lock_guard lock(mutex_);
+  open_ = false;
+  held_ = false;
+  for (; size_ > 0; --size_) {
+    entries_[head_] = Entry();
+    head_ = (head_ + 1) % entries_.size();
+  }
+  buffering_ = true;
+  spurt_packets_ = -1;
+  concealed_frames_ = 0;
+}
+
+void JitterBuffer::Reset() {
+  Clear();
+  std::lock_guard lock(mutex_);
+  ended_ = false;
+}
+
+JitterBuffer::Result JitterBuffer::Pop(FlexArray<uint8_t>& packet) {
+  std::lock_guard lock(mutex_);
+  if (buffering_) {
+    if (size_ == 0 && ended_) {
+      ended_ = false;
+      return Result::kEnded;
+    }
+
+    if (held_ || (size_ < std::min(TargetDepth(), entries_.size()) && !ended_)) {
+      return Result::kBuffering;
+    }
+    buffering_ = false;
+  }
+
+  if (size_ == 0) {
+    if (ended_ || concealed_frames_ >= kMaxConcealedFrames) {
+      // A new talk spurt starts with the next packet, the pause itself is not lateness.
+      buffering_ = true;
+      spurt_packets_ = -1;
+      concealed_frames_ = 0;
+      if (ended_) {
+        ended_ = false;
+        return Result::kEnded;
+      }
+      return Result::kBuffering;
+    }
+    ++concealed_frames_;
+    ++underrun_count_;
+    return Result::kUnderrun;
+  }
+
+  concealed_frames_ = 0;
+  auto& entry = entries_[head_];
+  head_ = (head_ + 1) % entries_.size();
+  --size_;
+  if (!entry.lost) {
+    packet = std::move(entry.packet);
+    return Result::kPacket;
+  }
+
+  entry.lost = false;
+  const auto& next = entries_[head_];
+  if (size_ > 0 && !next.lost) {
+    packet = FlexArray<uint8_t>(packet_pool_, next.packet.size());
+    if (packet.data() != nullptr) {
+      memcpy(packet.data(), next.packet.data(), next.packet.size());
+    } else {
+      // Out of memory, the lost frame is concealed without its FEC.
+      packet = FlexArray<uint8_t>();
+    }
+  } else {
+    packet = FlexArray<uint8_t>();
+  }
+  return Result::kLost;
+}
+
+size_t JitterBuffer::target_depth() const {
+  std::lock_guard lock(mutex_);
+  return TargetDepth();
+}
+
+size_t JitterBuffer::TargetDepth() const {
+  // One frame plus enough to cover the lateness peak.
+  return std::clamp<size_t>(1 + (jitter_us_ + frame_duration_us_ - 1) / frame_duration_us_, kMinTargetDepth, kMaxTargetDepth);
+}
+
+void JitterBuffer::Append(FlexArray<uint8_t>&& packet, const bool lost) {
+  if (size_ == entries_.size()) {
+    // Full: the new packet is dropped, the speech before it plays in order.
+    if (overrun_count_++ == 0) {
+      CLOGW("jitter buffer overrun");
+    }
+    return;
+  }
+
+  auto& entry = entries_[(head_ + size_) % entries_.size()];
+  entry.packet = std::move(packet);
+  entry.lost = lost;
+  ++size_;
+}
+
+void JitterBuffer::UpdateJitter() {
+  // Lateness against the earliest schedule of the talk spurt, a packet ahead of it moves it earlier.
+  const auto now = esp_timer_get_time();
+  ++spurt_packets_;
+  const auto expected = schedule_base_us_ + spurt_packets_ * frame_duration_us_;
+  if (spurt_packets_ == 0 || now < expected) {
+    schedule_base_us_ = now - spurt_packets_ * frame_duration_us_;
+    return;
+  }
+  jitter_us_ = std::max(now - expected, jitter_us_ - jitter_us_ / kJitterDecay);
+}
\ No newline at end of file
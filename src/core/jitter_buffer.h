@@ -0,0 +1,87 @@
+#pragma once
+
+#ifndef _JITTER_BUFFER_H_
+#define _JITTER_BUFFER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "flex_array/flex_array.h"
+
+// Playout buffer for the downlink Opus packets, popped once per frame. Plays from a target depth that follows the packet lateness.
+// Accepts packets from Open() to the next Clear() or Reset(), holds them until Play().
+class JitterBuffer {
+ public:
+  static constexpr size_t kMaxTargetDepth = 8;  // frames
+  enum class Result {
+    kPacket,     // |packet| holds the next packet
+    kLost,       // a packet was lost, |packet| holds the following one for FEC when it already arrived, empty otherwise
+    kUnderrun,   // nothing to play while the stream goes on, conceal the frame
+    kBuffering,  // nothing to play yet, wait for Push()
+    kEnded,      // everything before End() was played
+  };
+
+  // |capacity| packets, a packet pushed while it is full is dropped. The copy of a packet taken for FEC comes from |packet_pool|.
+  JitterBuffer(const uint32_t frame_duration, const size_t capacity, BufferPool* packet_pool);
+
+  // Producer side. Push() and PushLost() return false when the buffer is closed, the packet is then dropped.
+  bool Push(FlexArray<uint8_t>&& packet);
+  bool PushLost();
+  void End();
+  // Accepts packets of a new stream, held until Play(). Does nothing when already open.
+  void Open();
+  // Lets the stream opened play.
+  void Play();
+  // Drops every packet not played yet and closes the buffer, an End() already received is kept.
+  void Clear();
+  // Drops every packet not played yet and an End() already received and closes the buffer, for a new stream.
+  void Reset();
+
+  // Consumer side.
+  Result Pop(FlexArray<uint8_t>& packet);
+
+  size_t target_depth() const;
+
+  uint32_t underrun_count() const {
+    return underrun_count_;
+  }
+
+  // Packets dropped on arrival because the buffer was full.
+  uint32_t overrun_count() const {
+    return overrun_count_;
+  }
+
+ private:
+  JitterBuffer(const JitterBuffer&) = delete;
+  JitterBuffer& operator=(const JitterBuffer&) = delete;
+
+  struct Entry {
+    FlexArray<uint8_t> packet;
+    bool lost = false;
+  };
+
+  void Append(FlexArray<uint8_t>&& packet, const bool lost);
+  void UpdateJitter();
+  size_t TargetDepth() const;
+
+  const int64_t frame_duration_us_ = 0;
+  BufferPool* const packet_pool_ = nullptr;
+  mutable std::mutex mutex_;
+  std::vector<Entry> entries_;
+  size_t head_ = 0;
+  size_t size_ = 0;
+  bool open_ = false;
+  bool held_ = false;
+  bool buffering_ = true;
+  bool ended_ = false;
+  uint32_t concealed_frames_ = 0;
+  int64_t schedule_base_us_ = 0;
+  int64_t spurt_packets_ = -1;  // packets pushed in the current talk spurt, -1 before the first one
+  int64_t jitter_us_ = 0;
+  uint32_t underrun_count_ = 0;
+  uint32_t overrun_count_ = 0;
+};
+
+#endif
\ No newline at end of file
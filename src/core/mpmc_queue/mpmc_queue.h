@@ -0,0 +1,101 @@
+#pragma once
+
+#ifndef _MPMC_QUEUE_H_
+#define _MPMC_QUEUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+// Bounded lock-free MPMC FIFO (D. Vyukov's algorithm), allocated once. TryPush() and TryPop() never block nor allocate.
+template <typename T>
+class MpmcQueue {
+ public:
+  explicit MpmcQueue(const size_t capacity)
+      : capacity_(RoundUpPowerOfTwo(capacity)), mask_(capacity_ - 1), cells_(std::make_unique<Cell[]>(capacity_)) {
+    for (size_t i = 0; i < capacity_; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // Moves from |value| only on success, returns false when the queue is full.
+  bool TryPush(T& value) {
+    Cell* cell = nullptr;
+    auto position = push_position_.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &cells_[position & mask_];
+      const auto sequence = cell->sequence.load(std::memory_order_acquire);
+      const auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+      if (diff == 0) {
+        if (push_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        position = push_position_.load(std::memory_order_relaxed);
+      }
+    }
+
+    cell->value = std::move(value);
+    cell->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Returns false when the queue is empty, or when the oldest element is still being pushed.
+  bool TryPop(T& value) {
+    Cell* cell = nullptr;
+    auto position = pop_position_.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &cells_[position & mask_];
+      const auto sequence = cell->sequence.load(std::memory_order_acquire);
+      const auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+      if (diff == 0) {
+        if (pop_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        position = pop_position_.load(std::memory_order_relaxed);
+      }
+    }
+
+    value = std::move(cell->value);
+    // Leaves a moved-from element behind, reset so that what it owns is released now rather than when the cell is reused.
+    cell->value = T();
+    cell->sequence.store(position + capacity_, std::memory_order_release);
+    return true;
+  }
+
+  size_t capacity() const {
+    return capacity_;
+  }
+
+ private:
+  MpmcQueue(const MpmcQueue&) = delete;
+  MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+  struct Cell {
+    std::atomic<size_t> sequence = 0;
+    T value;
+  };
+
+  static constexpr size_t RoundUpPowerOfTwo(const size_t value) {
+    size_t result = 1;
+    while (result < value) {
+      result <<= 1;
+    }
+    return result;
+  }
+
+  const size_t capacity_ = 0;
+  const size_t mask_ = 0;
+  const std::unique_ptr<Cell[]> cells_;
+  std::atomic<size_t> push_position_ = 0;
+  std::atomic<size_t> pop_position_ = 0;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,92 @@
+#include "opus_packet_aggregator.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifndef CLOGGER_SEVERITY
+#define CLOGGER_SEVERITY CLOGGER_SEVERITY_WARN
+#endif
+#include "clogger/clogger.h"
+
+namespace {
+constexpr size_t kLengthSize = 2;
+constexpr size_t kCongestedQueueDepth = 2;
+constexpr int64_t kCongestedSendLoad = 50;  // percent of the audio duration carried by the message
+constexpr int64_t kFastSendLoad = 25;       // of the audio carried by one packet less
+constexpr uint32_t kShrinkSends = 10;
+}  // namespace
+
+OpusPacketAggregator::OpusPacketAggregator(const uint32_t max_packets,
+                                           const size_t max_packet_size,
+                                           const uint32_t frame_duration,
+                                           const size_t headroom)
+    : max_packets_(std::max<uint32_t>(max_packets, 1)),
+      frame_duration_us_(frame_duration * 1000),
+      headroom_(headroom),
+      buffer_(headroom + max_packets_ * (kLengthSize + max_packet_size)),
+      size_(headroom) {
+}
+
+bool OpusPacketAggregator::Unpack(const uint8_t* data, const size_t size, const PacketHandler& handler) {
+  size_t offset = 0;
+  while (offset < size) {
+    if (size - offset < kLengthSize) {
+      return false;
+    }
+
+    const size_t packet_size = (static_cast<size_t>(data[offset]) << 8) | data[offset + 1];
+    offset += kLengthSize;
+    if (packet_size == 0 || packet_size > size - offset) {
+      return false;
+    }
+
+    handler(data + offset, packet_size);
+    offset += packet_size;
+  }
+  return true;
+}
+
+bool OpusPacketAggregator::Append(const uint8_t* packet, const size_t size) {
+  if (size == 0 || size > 0xFFFF || kLengthSize + size > buffer_.size() - size_) {
+    CLOGW("packet of %zu bytes dropped", size);
+    return packet_count_ > 0;
+  }
+
+  auto* position = buffer_.data() + size_;
+  position[0] = static_cast<uint8_t>(size >> 8);
+  position[1] = static_cast<uint8_t>(size);
+  memcpy(position + kLengthSize, packet, size);
+  size_ += kLengthSize + size;
+  return ++packet_count_ >= packets_per_message_;
+}
+
+void OpusPacketAggregator::OnSent(const int64_t send_time_us, const size_t queue_depth) {
+  const auto duration_us = frame_duration_us_ * packet_count_;
+  Clear();
+
+  if (queue_depth >= kCongestedQueueDepth || send_time_us * 100 > duration_us * kCongestedSendLoad) {
+    fast_sends_ = 0;
+    if (packets_per_message_ < max_packets_) {
+      ++packets_per_message_;
+      CLOGI("%" PRIu32 " packets per message, send time: %lld us, queue depth: %zu", packets_per_message_, send_time_us, queue_depth);
+    }
+    return;
+  }
+
+  if (packets_per_message_ == 1 || queue_depth > 0 ||
+      send_time_us * 100 > frame_duration_us_ * (packets_per_message_ - 1) * kFastSendLoad) {
+    fast_sends_ = 0;
+    return;
+  }
+
+  if (++fast_sends_ >= kShrinkSends) {
+    fast_sends_ = 0;
+    --packets_per_message_;
+    CLOGI("%" PRIu32 " packets per message", packets_per_message_);
+  }
+}
+
+void OpusPacketAggregator::Clear() {
+  size_ = headroom_;
+  packet_count_ = 0;
+}
\ No newline at end of file
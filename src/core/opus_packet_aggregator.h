@@ -0,0 +1,61 @@
+#pragma once
+
+#ifndef _OPUS_PACKET_AGGREGATOR_H_
+#define _OPUS_PACKET_AGGREGATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "flex_array/flex_array.h"
+
+// Packs Opus packets into one websocket message, each after its 16-bit big-endian length, as many as the send times allow.
+// The message starts after |headroom| bytes. Not thread-safe.
+class OpusPacketAggregator {
+ public:
+  using PacketHandler = std::function<void(const uint8_t* packet, const size_t size)>;
+
+  OpusPacketAggregator(const uint32_t max_packets, const size_t max_packet_size, const uint32_t frame_duration, const size_t headroom);
+
+  // Calls |handler| for every packet of |data|, false when it is malformed.
+  static bool Unpack(const uint8_t* data, const size_t size, const PacketHandler& handler);
+
+  // True when the message is due. A packet that does not fit is dropped.
+  bool Append(const uint8_t* packet, const size_t size);
+  // Reports the send of the current message, which is then emptied.
+  void OnSent(const int64_t send_time_us, const size_t queue_depth);
+  void Clear();
+
+  // The headroom followed by the message, valid until the next call to Append(), OnSent() or Clear().
+  uint8_t* data() const {
+    return buffer_.data();
+  }
+
+  // Of the message, without the headroom.
+  size_t size() const {
+    return size_ - headroom_;
+  }
+
+  uint32_t packet_count() const {
+    return packet_count_;
+  }
+
+  uint32_t packets_per_message() const {
+    return packets_per_message_;
+  }
+
+ private:
+  OpusPacketAggregator(const OpusPacketAggregator&) = delete;
+  OpusPacketAggregator& operator=(const OpusPacketAggregator&) = delete;
+
+  const uint32_t max_packets_ = 0;
+  const int64_t frame_duration_us_ = 0;
+  const size_t headroom_ = 0;
+  FlexArray<uint8_t> buffer_;
+  size_t size_ = 0;
+  uint32_t packet_count_ = 0;
+  uint32_t packets_per_message_ = 1;
+  uint32_t fast_sends_ = 0;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,101 @@
+#include "opus_rate_controller.h"
+
+#include <esp_heap_caps.h>
+
+#include <algorithm>
+
+#include "libopus/opus.h"
+
+#ifndef CLOGGER_SEVERITY
+#define CLOGGER_SEVERITY CLOGGER_SEVERITY_WARN
+#endif
+#include "clogger/clogger.h"
+
+namespace {
+// Ordered from the cheapest to the best quality.
+constexpr OpusRateController::Level kLevels[] = {
+    {6000, 0, OPUS_BANDWIDTH_NARROWBAND},
+    {8000, 0, OPUS_BANDWIDTH_MEDIUMBAND},
+    {8000, 0, OPUS_BANDWIDTH_WIDEBAND},
+    {12000, 3, OPUS_BANDWIDTH_WIDEBAND},
+    {16000, 5, OPUS_BANDWIDTH_WIDEBAND},
+    {24000, 5, OPUS_BANDWIDTH_WIDEBAND},
+};
+constexpr size_t kMaxLevelWithoutPsram = 2;
+
+constexpr uint32_t kWindowFrames = 5;
+constexpr uint32_t kUpgradeWindows = 10;
+constexpr size_t kCongestedQueueDepth = 3;
+constexpr size_t kCleanQueueDepth = 1;
+constexpr int64_t kCongestedSendTimeUs = 100 * 1000;
+constexpr int64_t kCleanSendTimeUs = 40 * 1000;
+constexpr int64_t kCongestedEncodeLoad = 60;  // percent of the frame duration
+constexpr int64_t kCleanEncodeLoad = 30;
+}  // namespace
+
+OpusRateController::OpusRateController(const size_t max_level)
+    : max_level_(std::min(max_level, sizeof(kLevels) / sizeof(kLevels[0]) - 1)), level_index_(max_level_) {
+}
+
+size_t OpusRateController::MaxLevel() {
+  return heap_caps_get_total_size(MALLOC_CAP_SPIRAM) == 0 ? kMaxLevelWithoutPsram : sizeof(kLevels) / sizeof(kLevels[0]) - 1;
+}
+
+void OpusRateController::OnQueueDepth(const size_t depth) {
+  auto max_depth = max_queue_depth_.load(std::memory_order_relaxed);
+  while (depth > max_depth && !max_queue_depth_.compare_exchange_weak(max_depth, depth, std::memory_order_relaxed)) {
+  }
+}
+
+void OpusRateController::OnSend(const int64_t send_time_us) {
+  const auto average = send_time_us_.load(std::memory_order_relaxed);
+  send_time_us_.store(average + (send_time_us - average) / 4, std::memory_order_relaxed);
+}
+
+bool OpusRateController::Update(const int64_t encode_time_us, const int64_t frame_duration_us) {
+  encode_time_us_ = std::max(encode_time_us_, encode_time_us);
+  if (++window_frames_ < kWindowFrames) {
+    return false;
+  }
+
+  const auto queue_depth = max_queue_depth_.exchange(0, std::memory_order_relaxed);
+  const auto send_time_us = send_time_us_.load(std::memory_order_relaxed);
+  const auto encode_load = encode_time_us_ * 100 / frame_duration_us;
+  window_frames_ = 0;
+  encode_time_us_ = 0;
+
+  const auto level_index = level_index_.load(std::memory_order_relaxed);
+  if (queue_depth >= kCongestedQueueDepth || send_time_us >= kCongestedSendTimeUs || encode_load >= kCongestedEncodeLoad) {
+    clean_windows_ = 0;
+    if (level_index == 0) {
+      return false;
+    }
+    level_index_.store(level_index - 1, std::memory_order_relaxed);
+    downgrade_count_.fetch_add(1, std::memory_order_relaxed);
+    CLOGW("lower opus level to %zu, queue depth: %zu, send time: %lld us, encode load: %lld%%",
+          level_index - 1,
+          queue_depth,
+          send_time_us,
+          encode_load);
+    return true;
+  }
+
+  if (queue_depth > kCleanQueueDepth || send_time_us > kCleanSendTimeUs || encode_load > kCleanEncodeLoad) {
+    clean_windows_ = 0;
+    return false;
+  }
+
+  if (++clean_windows_ < kUpgradeWindows || level_index >= max_level_) {
+    return false;
+  }
+
+  clean_windows_ = 0;
+  level_index_.store(level_index + 1, std::memory_order_relaxed);
+  upgrade_count_.fetch_add(1, std::memory_order_relaxed);
+  CLOGI("raise opus level to %zu", level_index + 1);
+  return true;
+}
+
+const OpusRateController::Level& OpusRateController::level() const {
+  return kLevels[level_index_.load(std::memory_order_relaxed)];
+}
\ No newline at end of file
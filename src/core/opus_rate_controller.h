@@ -0,0 +1,66 @@
+#pragma once
+
+#ifndef _OPUS_RATE_CONTROLLER_H_
+#define _OPUS_RATE_CONTROLLER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Picks the Opus encoder settings from the queue depth, send and encode times: down after a congested window, up after several
+// clean ones.
+class OpusRateController {
+ public:
+  struct Level {
+    int32_t bitrate;
+    int32_t complexity;
+    int32_t bandwidth;
+  };
+
+  explicit OpusRateController(const size_t max_level);
+
+  static size_t MaxLevel();
+
+  void OnQueueDepth(const size_t depth);
+  void OnSend(const int64_t send_time_us);
+  bool Update(const int64_t encode_time_us, const int64_t frame_duration_us);
+
+  const Level& level() const;
+
+  size_t level_index() const {
+    return level_index_;
+  }
+
+  uint32_t downgrade_count() const {
+    return downgrade_count_.load(std::memory_order_relaxed);
+  }
+
+  uint32_t upgrade_count() const {
+    return upgrade_count_.load(std::memory_order_relaxed);
+  }
+
+  uint32_t dropped_frames() const {
+    return dropped_frames_.load(std::memory_order_relaxed);
+  }
+
+  void OnFrameDropped() {
+    dropped_frames_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+ private:
+  OpusRateController(const OpusRateController&) = delete;
+  OpusRateController& operator=(const OpusRateController&) = delete;
+
+  const size_t max_level_ = 0;
+  std::atomic<size_t> level_index_ = 0;
+  std::atomic<size_t> max_queue_depth_ = 0;
+  std::atomic<int64_t> send_time_us_ = 0;
+  int64_t encode_time_us_ = 0;
+  uint32_t window_frames_ = 0;
+  uint32_t clean_windows_ = 0;
+  std::atomic<uint32_t> downgrade_count_ = 0;
+  std::atomic<uint32_t> upgrade_count_ = 0;
+  std::atomic<uint32_t> dropped_frames_ = 0;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,13 @@
+#pragma once
+
+#ifndef _OPUS_SAMPLE_RATE_H_
+#define _OPUS_SAMPLE_RATE_H_
+
+#include <cstdint>
+
+// Sample rates the Opus encoder and decoder run at natively, any other rate needs a resampler in front of them.
+constexpr bool IsOpusSampleRate(const uint32_t sample_rate) {
+  return sample_rate == 8000 || sample_rate == 12000 || sample_rate == 16000 || sample_rate == 24000 || sample_rate == 48000;
+}
+
+#endif
\ No newline at end of file
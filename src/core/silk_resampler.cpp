@@ -38,12 +38,16 @@ SilkResampler::~SilkResampler() {
 }
 
 FlexArray<int16_t> SilkResampler::Resample(FlexArray<int16_t> &&input_pcm) const {
-  FlexArray<int16_t> output_pcm(input_pcm.size() * output_sample_rate_ / input_sample_rate_);
-  const auto ret =
-      silk_resampler(reinterpret_cast<silk_resampler_state_struct *>(silk_resampler_), output_pcm.data(), input_pcm.data(), input_pcm.size());
+  FlexArray<int16_t> output_pcm(input_pcm.pool(), input_pcm.size() * output_sample_rate_ / input_sample_rate_);
+  Resample(input_pcm.data(), input_pcm.size(), output_pcm.data());
+  return output_pcm;
+}
+
+size_t SilkResampler::Resample(const int16_t *input_pcm, const size_t input_samples, int16_t *output_pcm) const {
+  const auto ret = silk_resampler(reinterpret_cast<silk_resampler_state_struct *>(silk_resampler_), output_pcm, input_pcm, input_samples);
   if (ret != 0) {
     CLOGE("silk_resampler_process failed with: %d", ret);
     abort();
   }
-  return output_pcm;
+  return input_samples * output_sample_rate_ / input_sample_rate_;
 }
\ No newline at end of file
@@ -20,6 +20,7 @@ class SilkResampler {
   }
 
   FlexArray<int16_t> Resample(FlexArray<int16_t> &&input_pcm) const;
+  size_t Resample(const int16_t *input_pcm, const size_t input_samples, int16_t *output_pcm) const;
 
  private:
   const uint32_t input_sample_rate_ = 0;
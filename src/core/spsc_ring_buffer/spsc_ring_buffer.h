@@ -0,0 +1,115 @@
+#pragma once
+
+#ifndef _SPSC_RING_BUFFER_H_
+#define _SPSC_RING_BUFFER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+
+// Lock-free SPSC ring buffer, allocated once. Write() from one task, Read(), ReadSome() and Clear() from one other.
+template <typename T>
+class SpscRingBuffer {
+  static_assert(std::is_trivial_v<T>, "SpscRingBuffer supports only trivial types");
+
+ public:
+  explicit SpscRingBuffer(const size_t capacity) noexcept
+      : capacity_(RoundUpPowerOfTwo(capacity)), mask_(capacity_ - 1), buffer_(reinterpret_cast<T*>(std::malloc(capacity_ * sizeof(T)))) {
+  }
+
+  ~SpscRingBuffer() {
+    if (buffer_ != nullptr) {
+      std::free(buffer_);
+    }
+  }
+
+  // Producer side. Writes all |count| elements or nothing, returns false when there is not enough free space.
+  bool Write(const T* data, const size_t count) noexcept {
+    const auto write_index = write_index_.load(std::memory_order_relaxed);
+    const auto read_index = read_index_.load(std::memory_order_acquire);
+    if (capacity_ - (write_index - read_index) < count) {
+      return false;
+    }
+
+    const auto offset = write_index & mask_;
+    const auto first = count < capacity_ - offset ? count : capacity_ - offset;
+    std::memcpy(buffer_ + offset, data, first * sizeof(T));
+    std::memcpy(buffer_, data + first, (count - first) * sizeof(T));
+    write_index_.store(write_index + count, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Reads exactly |count| elements or nothing, returns false when fewer are available.
+  bool Read(T* data, const size_t count) noexcept {
+    const auto read_index = read_index_.load(std::memory_order_relaxed);
+    const auto write_index = write_index_.load(std::memory_order_acquire);
+    if (write_index - read_index < count) {
+      return false;
+    }
+
+    const auto offset = read_index & mask_;
+    const auto first = count < capacity_ - offset ? count : capacity_ - offset;
+    std::memcpy(data, buffer_ + offset, first * sizeof(T));
+    std::memcpy(data + first, buffer_, (count - first) * sizeof(T));
+    read_index_.store(read_index + count, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Reads at most |count| elements, returns how many were read.
+  size_t ReadSome(T* data, const size_t count) noexcept {
+    const auto available = Size();
+    const auto read_count = available < count ? available : count;
+    if (read_count > 0) {
+      Read(data, read_count);
+    }
+    return read_count;
+  }
+
+  // Consumer side. Drops everything written so far.
+  void Clear() noexcept {
+    read_index_.store(write_index_.load(std::memory_order_acquire), std::memory_order_release);
+  }
+
+  // Consumer side. Drops what was written before |position|, a write_position() taken earlier, and keeps what was written since.
+  void ClearUntil(const size_t position) noexcept {
+    const auto read_index = read_index_.load(std::memory_order_relaxed);
+    if (static_cast<std::make_signed_t<size_t>>(position - read_index) > 0) {
+      read_index_.store(position, std::memory_order_release);
+    }
+  }
+
+  // Position after the last element written, from any task.
+  size_t write_position() const noexcept {
+    return write_index_.load(std::memory_order_acquire);
+  }
+
+  size_t Size() const noexcept {
+    return write_index_.load(std::memory_order_acquire) - read_index_.load(std::memory_order_acquire);
+  }
+
+  size_t capacity() const noexcept {
+    return capacity_;
+  }
+
+ private:
+  SpscRingBuffer(const SpscRingBuffer&) = delete;
+  SpscRingBuffer& operator=(const SpscRingBuffer&) = delete;
+
+  static constexpr size_t RoundUpPowerOfTwo(const size_t value) {
+    size_t result = 1;
+    while (result < value) {
+      result <<= 1;
+    }
+    return result;
+  }
+
+  const size_t capacity_ = 0;
+  const size_t mask_ = 0;
+  T* const buffer_ = nullptr;
+  std::atomic<size_t> write_index_ = 0;
+  std::atomic<size_t> read_index_ = 0;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,516 @@
+#pragma once
+
+#ifndef _SERIAL_QUEUE_H_
+#define _SERIAL_QUEUE_H_
+
+#include <freertos/FreeRTOS.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "core/mpmc_queue/mpmc_queue.h"
+
+// A task whose captures do not fit inline is a compile error, define to 0 to allow it as a counted heap allocation instead.
+#ifndef TASK_QUEUE_STRICT_INLINE
+#define TASK_QUEUE_STRICT_INLINE (1)
+#endif
+
+// The queue half of TaskQueue and Strand: tasks run one at a time in FIFO order, delayed ones when due, from RunNext(). Enqueuing
+// is lock-free, an unbounded queue spills to a locked list once its FIFO is full.
+class SerialQueue {
+ public:
+  // Bytes of captures stored inside the queue, larger tasks are moved to the heap.
+  static constexpr size_t kInlineSize = 8 * sizeof(void*);
+
+  using TimePoint = std::chrono::time_point<std::chrono::steady_clock>;
+
+  using Duration = TimePoint::duration;
+
+  // Stops its timer on Cancel(), reassignment or destruction. A run in progress finishes.
+  class TimerHandle {
+   public:
+    TimerHandle() = default;
+    TimerHandle(TimerHandle&& other) = default;
+
+    TimerHandle& operator=(TimerHandle&& other) noexcept {
+      if (this != &other) {
+        Cancel();
+        cancelled_ = std::move(other.cancelled_);
+      }
+      return *this;
+    }
+
+    ~TimerHandle() {
+      Cancel();
+    }
+
+    void Cancel() {
+      if (cancelled_) {
+        cancelled_->store(true, std::memory_order_release);
+        cancelled_.reset();
+      }
+    }
+
+   private:
+    friend class SerialQueue;
+
+    explicit TimerHandle(std::shared_ptr<std::atomic<bool>> cancelled) : cancelled_(std::move(cancelled)) {
+    }
+
+    TimerHandle(const TimerHandle&) = delete;
+    TimerHandle& operator=(const TimerHandle&) = delete;
+
+    std::shared_ptr<std::atomic<bool>> cancelled_;
+  };
+
+  // What Enqueue() does when a bounded queue is full.
+  enum class OverflowPolicy {
+    kDropNewest,  // the task being enqueued is discarded
+    kDropOldest,  // the oldest queued task is discarded by the worker before it runs anything else
+  };
+
+  template <class F, class... Args>
+  void Enqueue(F&& f, Args&&... args) {
+    Push(TimePoint(), 0, false, nullptr, std::forward<F>(f), std::forward<Args>(args)...);
+  }
+
+  template <class F, class... Args>
+  void EnqueueAt(std::chrono::time_point<std::chrono::steady_clock> time_point, F&& f, Args&&... args) {
+    Push(std::move(time_point), 0, false, nullptr, std::forward<F>(f), std::forward<Args>(args)...);
+  }
+
+  // Runs the task only if |epoch| is still the current epoch when it is due, see epoch() and NewEpoch().
+  template <class F, class... Args>
+  void EnqueueInEpoch(const uint32_t epoch, F&& f, Args&&... args) {
+    Push(TimePoint(), epoch, true, nullptr, std::forward<F>(f), std::forward<Args>(args)...);
+  }
+
+  // Runs |f| after |delay|, then every |period| unless zero, missed runs skipped, each up to |tolerance| late. Clear() keeps it.
+  template <class F>
+  [[nodiscard]] TimerHandle StartTimer(const Duration delay, const Duration period, const Duration tolerance, F&& f) {
+    auto timer = std::make_shared<Timer>();
+    timer->period = period;
+    timer->tolerance = tolerance;
+    TimerHandle handle(std::shared_ptr<std::atomic<bool>>(timer, &timer->cancelled));
+    Push(std::chrono::steady_clock::now() + delay, 0, false, std::move(timer), std::forward<F>(f));
+    return handle;
+  }
+
+  uint32_t epoch() const {
+    return epoch_.load(std::memory_order_acquire);
+  }
+
+  // Cancels every task enqueued with EnqueueInEpoch() for an older epoch, other tasks are not affected. Returns the new epoch.
+  uint32_t NewEpoch() {
+    return epoch_.fetch_add(1, std::memory_order_acq_rel) + 1;
+  }
+
+  // Discards every pending task but the timers and starts a new epoch. Captures are released by the worker, outside of any lock.
+  uint32_t Clear() {
+    generation_.fetch_add(1, std::memory_order_acq_rel);
+    const auto epoch = NewEpoch();
+    Wake();
+    return epoch;
+  }
+
+  // Pending tasks, including delayed ones but not the one running. Approximate while other tasks enqueue.
+  size_t Size() const {
+    return pending_count_.load(std::memory_order_acquire);
+  }
+
+  // Tasks waiting in the FIFO, what the capacity bounds. May exceed the capacity with kDropOldest until the worker evicts.
+  size_t queued_count() const {
+    return queued_count_.load(std::memory_order_acquire);
+  }
+
+  // Tasks discarded because the queue was full.
+  uint32_t dropped_count() const {
+    return dropped_count_.load(std::memory_order_relaxed);
+  }
+
+  // Tasks whose captures did not fit in kInlineSize and were allocated on the heap.
+  uint32_t heap_task_count() const {
+    return heap_task_count_.load(std::memory_order_relaxed);
+  }
+
+  // Tasks that went through the overflow list of an unbounded queue.
+  uint32_t spilled_count() const {
+    return spilled_count_.load(std::memory_order_relaxed);
+  }
+
+  // Bypasses the capacity and the epoch, Clear() still discards it.
+  template <class F>
+  void EnqueueUnbounded(F&& f) {
+    pending_count_.fetch_add(1, std::memory_order_relaxed);
+    Task task{next_id_.fetch_add(1, std::memory_order_relaxed),
+              generation_.load(std::memory_order_acquire),
+              TimePoint(),
+              0,
+              false,
+              nullptr,
+              Callable(std::forward<F>(f)),
+              false};
+    if (spilled_.load(std::memory_order_acquire) || !fifo_.TryPush(task)) {
+      Spill(std::move(task));
+    }
+    Wake();
+  }
+
+  // Ticks to wait until |due_time|, at least one, portMAX_DELAY for TimePoint::max().
+  static TickType_t TicksUntil(const TimePoint due_time, const TimePoint now) {
+    if (due_time == TimePoint::max()) {
+      return portMAX_DELAY;
+    }
+    const auto delay = std::chrono::ceil<std::chrono::milliseconds>(due_time - now).count();
+    return std::max<TickType_t>(pdMS_TO_TICKS(std::max<decltype(delay)>(delay, 0)), 1);
+  }
+
+ protected:
+  // |capacity| 0 means unbounded. The FIFO of a bounded queue holds twice its capacity, for kDropOldest.
+  SerialQueue(const size_t capacity, const OverflowPolicy overflow_policy)
+      : capacity_(capacity), overflow_policy_(overflow_policy), fifo_(capacity > 0 ? capacity * 2 : kUnboundedFifoSize) {
+    timers_.reserve(kReservedTimers);
+  }
+
+  virtual ~SerialQueue() = default;
+
+  // Called after a task is enqueued, the worker must then call RunNext() until it returns false.
+  virtual void Wake() = 0;
+
+  // Worker side. Runs or files one task, returns false when nothing is due.
+  bool RunNext(const TimePoint now) {
+    const auto epoch = epoch_.load(std::memory_order_acquire);
+    if (epoch != purged_epoch_) {
+      purged_epoch_ = epoch;
+      PurgeCancelledTimers();
+    }
+
+    Task task;
+    if (!timers_.empty() && (timers_.front().scheduled_time <= now || Cancelled(timers_.front()))) {
+      std::pop_heap(timers_.begin(), timers_.end(), std::greater<>());
+      task = std::move(timers_.back());
+      timers_.pop_back();
+      Run(task);
+      return true;
+    }
+
+    if (!Pop(task)) {
+      return false;
+    }
+
+    if (task.scheduled_time > now && !Cancelled(task)) {
+      File(std::move(task));
+    } else {
+      Run(task);
+    }
+    return true;
+  }
+
+  // Worker side. The earliest due time plus tolerance, TimePoint::max() without delayed tasks.
+  TimePoint next_due_time() const {
+    auto due_time = TimePoint::max();
+    for (const auto& task : timers_) {
+      // Purged on the next run, no need to wake up for them.
+      if (Cancelled(task)) {
+        continue;
+      }
+      due_time = std::min(due_time, task.timer ? task.scheduled_time + task.timer->tolerance : task.scheduled_time);
+    }
+    return due_time;
+  }
+
+ private:
+  SerialQueue(const SerialQueue&) = delete;
+  SerialQueue& operator=(const SerialQueue&) = delete;
+
+  static constexpr size_t kUnboundedFifoSize = 32;
+  static constexpr size_t kReservedTimers = 8;
+
+  // Move-only type-erased callable, stored inline when small enough so that enqueuing does not allocate.
+  class Callable {
+   public:
+    Callable() = default;
+
+    template <typename Fn>
+    static constexpr bool kFitsInline =
+        sizeof(Fn) <= kInlineSize && alignof(Fn) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<Fn>;
+
+    template <typename F>
+    explicit Callable(F&& f) {
+      using Fn = std::decay_t<F>;
+      if constexpr (kFitsInline<Fn>) {
+        new (storage_) Fn(std::forward<F>(f));
+        ops_ = &kInlineOps<Fn>;
+      } else {
+        *reinterpret_cast<Fn**>(storage_) = new Fn(std::forward<F>(f));
+        ops_ = &kHeapOps<Fn>;
+      }
+    }
+
+    Callable(Callable&& other) noexcept : ops_(other.ops_) {
+      if (ops_ != nullptr) {
+        ops_->move(other.storage_, storage_);
+        other.ops_ = nullptr;
+      }
+    }
+
+    Callable& operator=(Callable&& other) noexcept {
+      if (this != &other) {
+        Reset();
+        ops_ = other.ops_;
+        if (ops_ != nullptr) {
+          ops_->move(other.storage_, storage_);
+          other.ops_ = nullptr;
+        }
+      }
+      return *this;
+    }
+
+    ~Callable() {
+      Reset();
+    }
+
+    void operator()() {
+      ops_->invoke(storage_);
+    }
+
+   private:
+    Callable(const Callable&) = delete;
+    Callable& operator=(const Callable&) = delete;
+
+    struct Ops {
+      void (*invoke)(void* storage);
+      void (*move)(void* from, void* to);
+      void (*destroy)(void* storage);
+    };
+
+    template <typename Fn>
+    static constexpr Ops kInlineOps = {
+        [](void* storage) { (*static_cast<Fn*>(storage))(); },
+        [](void* from, void* to) {
+          new (to) Fn(std::move(*static_cast<Fn*>(from)));
+          static_cast<Fn*>(from)->~Fn();
+        },
+        [](void* storage) { static_cast<Fn*>(storage)->~Fn(); },
+    };
+
+    template <typename Fn>
+    static constexpr Ops kHeapOps = {
+        [](void* storage) { (**static_cast<Fn**>(storage))(); },
+        [](void* from, void* to) { *static_cast<Fn**>(to) = *static_cast<Fn**>(from); },
+        [](void* storage) { delete *static_cast<Fn**>(storage); },
+    };
+
+    void Reset() {
+      if (ops_ != nullptr) {
+        ops_->destroy(storage_);
+        ops_ = nullptr;
+      }
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[kInlineSize];
+    const Ops* ops_ = nullptr;
+  };
+
+  // Shared by a timer task and its handle.
+  struct Timer {
+    std::atomic<bool> cancelled = false;
+    Duration period{};  // zero for a one-shot timer
+    Duration tolerance{};
+  };
+
+  struct Task {
+    uint32_t id = 0;
+    uint32_t generation = 0;  // of Clear() when enqueued, a later Clear() discards the task unless it is a timer
+    TimePoint scheduled_time;  // the epoch of the clock for immediate tasks
+    uint32_t epoch = 0;
+    bool in_epoch = false;
+    std::shared_ptr<Timer> timer;  // only for tasks started with StartTimer()
+    Callable task;
+    bool queued = true;  // counted in queued_count_, false for EnqueueUnbounded()
+
+    // Orders the timer heap, ids wrap around.
+    bool operator>(const Task& other) const {
+      return scheduled_time == other.scheduled_time ? static_cast<int32_t>(id - other.id) > 0 : scheduled_time > other.scheduled_time;
+    }
+  };
+
+  template <class F, class... Args>
+  void Push(TimePoint time_point, const uint32_t epoch, const bool in_epoch, std::shared_ptr<Timer> timer, F&& f, Args&&... args) {
+    auto func = [f = std::forward<F>(f), ... args = std::forward<Args>(args)]() mutable { f(std::forward<Args>(args)...); };
+#if TASK_QUEUE_STRICT_INLINE
+    static_assert(Callable::kFitsInline<decltype(func)>, "task captures do not fit in TaskQueue::kInlineSize");
+#endif
+    if (in_epoch && epoch != epoch_.load(std::memory_order_acquire)) {
+      return;
+    }
+
+    if (!Admit()) {
+      dropped_count_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    pending_count_.fetch_add(1, std::memory_order_relaxed);
+
+    if constexpr (!Callable::kFitsInline<decltype(func)>) {
+      heap_task_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+    Task task{next_id_.fetch_add(1, std::memory_order_relaxed),
+              generation_.load(std::memory_order_acquire),
+              std::move(time_point),
+              epoch,
+              in_epoch,
+              std::move(timer),
+              Callable(std::move(func))};
+    // Once a task is spilled the following ones are spilled too until the worker has taken them, to keep the FIFO order.
+    if (spilled_.load(std::memory_order_acquire) || !fifo_.TryPush(task)) {
+      Spill(std::move(task));
+    }
+    Wake();
+  }
+
+  // Takes a place in the FIFO, kDropOldest up to twice the capacity.
+  bool Admit() {
+    if (capacity_ == 0) {
+      queued_count_.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+    const auto limit = overflow_policy_ == OverflowPolicy::kDropOldest ? capacity_ * 2 : capacity_;
+    auto queued_count = queued_count_.load(std::memory_order_relaxed);
+    do {
+      if (queued_count >= limit) {
+        return false;
+      }
+    } while (!queued_count_.compare_exchange_weak(queued_count, queued_count + 1, std::memory_order_acq_rel, std::memory_order_relaxed));
+    return true;
+  }
+
+  void Spill(Task&& task) {
+    std::lock_guard<std::mutex> lock(spill_mutex_);
+    spill_.push_back(std::move(task));
+    spilled_.store(true, std::memory_order_release);
+    spilled_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Worker side. Tasks spilled earlier than what the FIFO holds now are taken first, then the FIFO, then the overflow list.
+  bool Pop(Task& task) {
+    if (spill_read_ < spill_batch_.size()) {
+      task = std::move(spill_batch_[spill_read_++]);
+      Dequeued(task);
+      return true;
+    }
+    spill_batch_.clear();
+    spill_read_ = 0;
+
+    while (fifo_.TryPop(task)) {
+      if (!Evicted(task)) {
+        return true;
+      }
+    }
+
+    if (spilled_.load(std::memory_order_acquire)) {
+      {
+        std::lock_guard<std::mutex> lock(spill_mutex_);
+        spill_batch_.swap(spill_);
+        spilled_.store(false, std::memory_order_release);
+      }
+      return Pop(task);
+    }
+    return false;
+  }
+
+  void Dequeued(const Task& task) {
+    if (task.queued) {
+      queued_count_.fetch_sub(1, std::memory_order_acq_rel);
+    }
+  }
+
+  // Worker side. kDropOldest discards a popped task while more than the capacity are queued, unless from EnqueueUnbounded().
+  bool Evicted(Task& task) {
+    const bool excess = overflow_policy_ == OverflowPolicy::kDropOldest && capacity_ > 0 &&
+                        queued_count_.load(std::memory_order_acquire) > capacity_;
+    Dequeued(task);
+    if (!excess || !task.queued) {
+      return false;
+    }
+    pending_count_.fetch_sub(1, std::memory_order_acq_rel);
+    dropped_count_.fetch_add(1, std::memory_order_relaxed);
+    task = Task();
+    return true;
+  }
+
+  bool Cancelled(const Task& task) const {
+    // Timers belong to their handles, which would otherwise still look running.
+    if (task.timer) {
+      return task.timer->cancelled.load(std::memory_order_acquire);
+    }
+    return task.generation != generation_.load(std::memory_order_acquire) ||
+           (task.in_epoch && task.epoch != epoch_.load(std::memory_order_acquire));
+  }
+
+  // Worker side. Delayed tasks discarded by Clear() or NewEpoch() would otherwise keep their captures until they are due.
+  void PurgeCancelledTimers() {
+    const auto cancelled = std::partition(timers_.begin(), timers_.end(), [this](const Task& task) { return !Cancelled(task); });
+    if (cancelled == timers_.end()) {
+      return;
+    }
+    // Moved out first: a capture destructor that enqueues to this queue finds the heap consistent.
+    std::vector<Task> discarded(std::make_move_iterator(cancelled), std::make_move_iterator(timers_.end()));
+    pending_count_.fetch_sub(discarded.size(), std::memory_order_acq_rel);
+    timers_.erase(cancelled, timers_.end());
+    std::make_heap(timers_.begin(), timers_.end(), std::greater<>());
+  }
+
+  // Worker side.
+  void File(Task&& task) {
+    timers_.push_back(std::move(task));
+    std::push_heap(timers_.begin(), timers_.end(), std::greater<>());
+  }
+
+  void Run(Task& task) {
+    pending_count_.fetch_sub(1, std::memory_order_acq_rel);
+    if (!Cancelled(task)) {
+      task.task();
+      if (task.timer && task.timer->period > Duration::zero() && !Cancelled(task)) {
+        // Counted from the end of the run, a run longer than the period skips the runs it overlapped.
+        const auto period = task.timer->period;
+        task.scheduled_time += period * ((std::chrono::steady_clock::now() - task.scheduled_time) / period + 1);
+        pending_count_.fetch_add(1, std::memory_order_relaxed);
+        File(std::move(task));
+        return;
+      }
+    }
+    task.task = Callable();
+    task.timer = nullptr;
+  }
+
+  const size_t capacity_ = 0;
+  const OverflowPolicy overflow_policy_ = OverflowPolicy::kDropNewest;
+  MpmcQueue<Task> fifo_;
+  std::mutex spill_mutex_;
+  std::vector<Task> spill_;
+  std::atomic<bool> spilled_ = false;
+  std::vector<Task> spill_batch_;  // worker only
+  size_t spill_read_ = 0;          // worker only
+  std::vector<Task> timers_;       // worker only, a min-heap on the scheduled time
+  uint32_t purged_epoch_ = 0;      // worker only
+  std::atomic<uint32_t> next_id_ = 0;
+  std::atomic<uint32_t> generation_ = 0;  // of Clear()
+  std::atomic<uint32_t> epoch_ = 0;
+  std::atomic<size_t> pending_count_ = 0;
+  std::atomic<size_t> queued_count_ = 0;
+  std::atomic<uint32_t> dropped_count_ = 0;
+  std::atomic<uint32_t> heap_task_count_ = 0;
+  std::atomic<uint32_t> spilled_count_ = 0;
+};
+
+#endif
\ No newline at end of file
@@ -6,26 +6,27 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 
-#include <chrono>
-#include <condition_variable>
-#include <functional>
-#include <memory>
-#include <mutex>
-#include <queue>
 #include <string>
-#include <utility>
+
+#include "core/task_queue/serial_queue.h"
 
 #define TASK_QUEUE_DEBUG (0)
 
-class TaskQueue {
+// A SerialQueue run by its own FreeRTOS task, for work that blocks for long.
+class TaskQueue : public SerialQueue {
  public:
-  TaskQueue(const std::string& name, const uint32_t stack_depth, UBaseType_t priority)
-      :
+  TaskQueue(const std::string& name,
+            const uint32_t stack_depth,
+            UBaseType_t priority,
+            const size_t capacity = 0,
+            const OverflowPolicy overflow_policy = OverflowPolicy::kDropNewest,
+            const BaseType_t core_id = tskNO_AFFINITY)
+      : SerialQueue(capacity, overflow_policy),
 #if TASK_QUEUE_DEBUG
         name_(name),
 #endif
-        stack_buffer_(new StackType_t[stack_depth]),
-        task_handle_(xTaskCreateStatic(&Loop, name.c_str(), stack_depth, this, priority, stack_buffer_, &task_buffer_)) {
+        stack_buffer_(new StackType_t[stack_depth]) {
+    task_handle_ = xTaskCreateStaticPinnedToCore(&Loop, name.c_str(), stack_depth, this, priority, stack_buffer_, &task_buffer_, core_id);
     assert(stack_buffer_ != nullptr && task_handle_ != nullptr);
     if (stack_buffer_ == nullptr || task_handle_ == nullptr) {
       abort();
@@ -34,72 +35,30 @@ class TaskQueue {
 
   ~TaskQueue() {
     const auto termination_sem = xSemaphoreCreateBinary();
-    Enqueue([termination_sem]() {
+    EnqueueUnbounded([termination_sem]() {
       xSemaphoreGive(termination_sem);
       vTaskDelay(portMAX_DELAY);
     });
     xSemaphoreTake(termination_sem, portMAX_DELAY);
     vSemaphoreDelete(termination_sem);
 #if TASK_QUEUE_DEBUG
-    printf("task %s minimum stack %u\n", name_.c_str(), uxTaskGetStackHighWaterMark(task_handle_));
+    printf("task %s minimum stack %u, heap tasks %u, spilled tasks %u\n",
+           name_.c_str(),
+           uxTaskGetStackHighWaterMark(task_handle_),
+           heap_task_count(),
+           spilled_count());
 #endif
     vTaskDelete(task_handle_);
     delete[] stack_buffer_;
   }
 
-  template <class F, class... Args>
-  void Enqueue(F&& f, Args&&... args) {
-    auto func = [f = std::forward<F>(f), ... args = std::forward<Args>(args)]() mutable { f(std::forward<Args>(args)...); };
-    {
-      std::lock_guard<std::mutex> lock(mutex_);
-      tasks_.emplace(Task{id_++, std::chrono::steady_clock::now(), std::make_unique<TaskImpl<decltype(func)>>(std::move(func))});
-    }
-    condition_.notify_one();
-  }
-
-  template <class F, class... Args>
-  void EnqueueAt(std::chrono::time_point<std::chrono::steady_clock> time_point, F&& f, Args&&... args) {
-    auto func = [f = std::forward<F>(f), ... args = std::forward<Args>(args)]() mutable { f(std::forward<Args>(args)...); };
-    {
-      std::lock_guard<std::mutex> lock(mutex_);
-      tasks_.emplace(Task{id_++, std::move(time_point), std::make_unique<TaskImpl<decltype(func)>>(std::move(func))});
-    }
-    condition_.notify_one();
-  }
-
-  size_t Size() const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return tasks_.size();
-  }
-
  private:
   TaskQueue(const TaskQueue&) = delete;
   TaskQueue& operator=(const TaskQueue&) = delete;
 
-  struct TaskInterface {
-    virtual void Invoke() = 0;
-    virtual ~TaskInterface() = default;
-  };
-
-  template <typename Callable>
-  struct TaskImpl : TaskInterface {
-    Callable callable;
-    explicit TaskImpl(Callable&& c) : callable(std::move(c)) {
-    }
-    void Invoke() override {
-      callable();
-    }
-  };
-
-  struct Task {
-    uint64_t id;
-    std::chrono::time_point<std::chrono::steady_clock> scheduled_time;
-    std::unique_ptr<TaskInterface> task;
-
-    bool operator>(const Task& other) const {
-      return scheduled_time == other.scheduled_time ? id > other.id : scheduled_time > other.scheduled_time;
-    }
-  };
+  void Wake() override {
+    xTaskNotifyGive(task_handle_);
+  }
 
   static void Loop(void* self) {
     reinterpret_cast<TaskQueue*>(self)->Loop();
@@ -107,33 +66,18 @@ class TaskQueue {
 
   void Loop() {
     while (true) {
-      std::unique_ptr<TaskInterface> task;
-      {
-        std::unique_lock<std::mutex> lock(mutex_);
-        condition_.wait(lock, [this] { return !tasks_.empty(); });
-
-        auto scheduled_time = tasks_.top().scheduled_time;
-
-        condition_.wait_until(lock, scheduled_time, [this, &scheduled_time] {
-          return std::chrono::steady_clock::now() >= tasks_.top().scheduled_time ? true : (scheduled_time = tasks_.top().scheduled_time, false);
-        });
-
-        task = std::move(const_cast<Task&>(tasks_.top()).task);
-        tasks_.pop();
+      const auto now = std::chrono::steady_clock::now();
+      if (!RunNext(now)) {
+        ulTaskNotifyTake(pdTRUE, TicksUntil(next_due_time(), now));
       }
-      task->Invoke();
     }
   }
 #if TASK_QUEUE_DEBUG
   const std::string name_;
 #endif
-  mutable std::mutex mutex_;
-  std::condition_variable condition_;
-  std::priority_queue<Task, std::vector<Task>, std::greater<>> tasks_;
   StackType_t* stack_buffer_ = nullptr;
   StaticTask_t task_buffer_;
   TaskHandle_t task_handle_ = nullptr;
-  uint64_t id_ = 0;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,158 @@
+#include "tls_session_cache.h"
+
+#include <esp_timer.h>
+#include <esp_tls.h>
+#include <mbedtls/ssl.h>
+#include <nvs.h>
+
+#include <cinttypes>
+#include <cstdio>
+#include <vector>
+
+#ifndef CLOGGER_SEVERITY
+#define CLOGGER_SEVERITY CLOGGER_SEVERITY_WARN
+#endif
+#include "clogger/clogger.h"
+
+namespace {
+constexpr char kNvsNamespace[] = "tls_sessions";
+
+// Short enough for an NVS key.
+std::string Key(const std::string& host, const int port) {
+  uint32_t hash = 2166136261u;  // FNV-1a
+  for (const auto c : host + ':' + std::to_string(port)) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+  }
+  char key[10];
+  snprintf(key, sizeof(key), "s%08" PRIx32, hash);
+  return key;
+}
+
+uint64_t Digest(const std::vector<uint8_t>& blob) {
+  uint64_t hash = 14695981039346656037ull;  // FNV-1a
+  for (const auto byte : blob) {
+    hash = (hash ^ byte) * 1099511628211ull;
+  }
+  return hash;
+}
+
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+// A resumed session keeps the start time of the one offered. No accessor in mbedTLS, MBEDTLS_PRIVATE() fails the build if it moves.
+bool Resumed(const esp_tls_client_session* offered, const esp_tls_client_session* negotiated) {
+#ifdef MBEDTLS_HAVE_TIME
+  return offered->saved_session.MBEDTLS_PRIVATE(start) == negotiated->saved_session.MBEDTLS_PRIVATE(start);
+#else
+  return false;
+#endif
+}
+#endif
+}  // namespace
+
+TlsSessionCache::TlsSessionCache(const bool persistent) : persistent_(persistent) {
+}
+
+TlsSessionCache::Session TlsSessionCache::Find(const std::string& host, const int port) {
+  const auto key = Key(host, port);
+  Session session;
+  {
+    std::lock_guard lock(mutex_);
+    auto it = sessions_.find(key);
+    if (it != sessions_.end()) {
+      session = it->second;
+    } else if (persistent_ && (session = Load(key)) != nullptr) {
+      sessions_.emplace(key, session);
+    }
+  }
+  CLOGI("%s:%d, %s", host.c_str(), port, session ? "found" : "none");
+  return session;
+}
+
+bool TlsSessionCache::Save(const std::string& host, const int port, esp_tls* tls, const Session& offered) {
+  bool resumed = false;
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+  Session session(esp_tls_get_client_session(tls), &esp_tls_free_client_session);
+  resumed = session && offered && Resumed(offered.get(), session.get());
+  if (session) {
+    const auto key = Key(host, port);
+    std::lock_guard lock(mutex_);
+    if (persistent_) {
+      Store(key, session.get());
+    }
+    sessions_[key] = std::move(session);
+  }
+#endif
+
+  (resumed ? hit_count_ : miss_count_).fetch_add(1, std::memory_order_relaxed);
+  CLOGI("%s:%d, hits: %" PRIu32 ", misses: %" PRIu32, host.c_str(), port, hit_count(), miss_count());
+  return resumed;
+}
+
+TlsSessionCache::Session TlsSessionCache::Load(const std::string& key) {
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+  nvs_handle_t handle = 0;
+  if (nvs_open(kNvsNamespace, NVS_READONLY, &handle) != ESP_OK) {
+    return nullptr;
+  }
+
+  size_t size = 0;
+  std::vector<uint8_t> blob;
+  if (nvs_get_blob(handle, key.c_str(), nullptr, &size) == ESP_OK) {
+    blob.resize(size);
+    if (nvs_get_blob(handle, key.c_str(), blob.data(), &size) != ESP_OK) {
+      blob.clear();
+    }
+  }
+  nvs_close(handle);
+  if (blob.empty()) {
+    return nullptr;
+  }
+
+  // Freed by esp_tls_free_client_session(), which frees the mbedTLS session and then the struct.
+  Session session(reinterpret_cast<esp_tls_client_session*>(calloc(1, sizeof(esp_tls_client_session))), &esp_tls_free_client_session);
+  if (!session) {
+    return nullptr;
+  }
+  mbedtls_ssl_session_init(&session->saved_session);
+  const auto ret = mbedtls_ssl_session_load(&session->saved_session, blob.data(), blob.size());
+  if (ret != 0) {
+    CLOGW("stale session %s dropped: -0x%x", key.c_str(), -ret);
+    return nullptr;
+  }
+  // Already in NVS, written again only once it changes.
+  stored_[key].digest = Digest(blob);
+  return session;
+#else
+  return nullptr;
+#endif
+}
+
+void TlsSessionCache::Store(const std::string& key, const esp_tls_client_session* session) {
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+  size_t size = 0;
+  mbedtls_ssl_session_save(&session->saved_session, nullptr, 0, &size);
+  std::vector<uint8_t> blob(size);
+  if (size == 0 || mbedtls_ssl_session_save(&session->saved_session, blob.data(), blob.size(), &size) != 0) {
+    return;
+  }
+
+  // Resuming by session ID leaves the session as it was, a server rotating tickets changes it on every connection.
+  auto& stored = stored_[key];
+  const auto digest = Digest(blob);
+  const auto now = esp_timer_get_time();
+  if (digest == stored.digest || (stored.time_us != INT64_MIN && now - stored.time_us < kMinStoreInterval)) {
+    return;
+  }
+
+  nvs_handle_t handle = 0;
+  if (nvs_open(kNvsNamespace, NVS_READWRITE, &handle) != ESP_OK) {
+    CLOGW("nvs_open failed");
+    return;
+  }
+  if (nvs_set_blob(handle, key.c_str(), blob.data(), size) != ESP_OK || nvs_commit(handle) != ESP_OK) {
+    CLOGW("saving session %s failed", key.c_str());
+  } else {
+    stored = Stored{digest, now};
+  }
+  nvs_close(handle);
+#endif
+}
\ No newline at end of file
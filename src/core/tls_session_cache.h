@@ -0,0 +1,63 @@
+#pragma once
+
+#ifndef _TLS_SESSION_CACHE_H_
+#define _TLS_SESSION_CACHE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+struct esp_tls;
+struct esp_tls_client_session;
+
+// TLS sessions by host and port, for the next connection to resume. |persistent| also keeps them in NVS, secrets included.
+// Thread-safe. Needs CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS.
+class TlsSessionCache {
+ public:
+  using Session = std::shared_ptr<esp_tls_client_session>;
+
+  explicit TlsSessionCache(const bool persistent);
+
+  static constexpr int64_t kMinStoreInterval = 5 * 60 * 1000000LL;  // us
+
+  // The session to offer to |host|, null when there is none.
+  Session Find(const std::string& host, const int port);
+  // Keeps the session of |tls|. True when the handshake resumed |offered|.
+  bool Save(const std::string& host, const int port, esp_tls* tls, const Session& offered);
+
+  // Handshakes that resumed the session offered.
+  uint32_t hit_count() const {
+    return hit_count_.load(std::memory_order_relaxed);
+  }
+
+  // Full handshakes, whether a session was offered or not.
+  uint32_t miss_count() const {
+    return miss_count_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  TlsSessionCache(const TlsSessionCache&) = delete;
+  TlsSessionCache& operator=(const TlsSessionCache&) = delete;
+
+  // What NVS holds for a key.
+  struct Stored {
+    uint64_t digest = 0;
+    int64_t time_us = INT64_MIN;  // of the last write, INT64_MIN when not written since boot
+  };
+
+  Session Load(const std::string& key);
+  // Under |mutex_|.
+  void Store(const std::string& key, const esp_tls_client_session* session);
+
+  const bool persistent_ = false;
+  std::mutex mutex_;
+  std::map<std::string, Session> sessions_;
+  std::map<std::string, Stored> stored_;
+  std::atomic<uint32_t> hit_count_ = 0;
+  std::atomic<uint32_t> miss_count_ = 0;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,156 @@
+#include "tls_session_transport.h"
+
+#include <esp_timer.h>
+#include <esp_tls.h>
+#include <sys/select.h>
+
+#include <cstring>
+
+#include "tls_session_cache.h"
+
+#ifndef CLOGGER_SEVERITY
+#define CLOGGER_SEVERITY CLOGGER_SEVERITY_WARN
+#endif
+#include "clogger/clogger.h"
+
+esp_transport_handle_t TlsSessionTransport::Create(TlsSessionCache* cache, esp_err_t (*crt_bundle_attach)(void* conf)) {
+  auto transport = esp_transport_init();
+  if (transport == nullptr) {
+    return nullptr;
+  }
+
+  esp_transport_set_context_data(transport, new TlsSessionTransport(cache, crt_bundle_attach));
+  esp_transport_set_func(transport, &Connect, &Read, &Write, &Close, &PollRead, &PollWrite, &Destroy);
+  return transport;
+}
+
+TlsSessionTransport::TlsSessionTransport(TlsSessionCache* cache, esp_err_t (*crt_bundle_attach)(void* conf))
+    : cache_(cache), crt_bundle_attach_(crt_bundle_attach) {
+}
+
+TlsSessionTransport::~TlsSessionTransport() {
+  Close();
+}
+
+TlsSessionTransport* TlsSessionTransport::self(esp_transport_handle_t transport) {
+  return reinterpret_cast<TlsSessionTransport*>(esp_transport_get_context_data(transport));
+}
+
+int TlsSessionTransport::Connect(esp_transport_handle_t transport, const char* host, int port, int timeout_ms) {
+  auto* const self = TlsSessionTransport::self(transport);
+  self->Close();
+  self->tls_ = esp_tls_init();
+  if (self->tls_ == nullptr) {
+    return -1;
+  }
+
+  esp_tls_cfg_t cfg;
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.crt_bundle_attach = self->crt_bundle_attach_;
+  cfg.timeout_ms = timeout_ms;
+  // Offered to the server, which falls back to a full handshake when it no longer knows the session.
+  const auto session = self->cache_->Find(host, port);
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+  cfg.client_session = session.get();
+#endif
+
+  [[maybe_unused]] const auto start_time = esp_timer_get_time();
+  if (esp_tls_conn_new_sync(host, strlen(host), port, &cfg, self->tls_) <= 0) {
+    CLOGE("tls connection to %s:%d failed", host, port);
+    self->Close();
+    return -1;
+  }
+
+  [[maybe_unused]] const auto resumed = self->cache_->Save(host, port, self->tls_, session);
+  CLOGI("tls handshake with %s:%d in %lld ms, %s", host, port, (esp_timer_get_time() - start_time) / 1000, resumed ? "resumed" : "full");
+  return 0;
+}
+
+int TlsSessionTransport::Read(esp_transport_handle_t transport, char* buffer, int len, int timeout_ms) {
+  auto* const self = TlsSessionTransport::self(transport);
+  const auto poll = self->Poll(timeout_ms, false);
+  if (poll < 0) {
+    return ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+  } else if (poll == 0) {
+    return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+  }
+
+  const auto ret = esp_tls_conn_read(self->tls_, buffer, len);
+  if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_TIMEOUT) {
+    return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+  } else if (ret < 0) {
+    return ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+  } else if (ret == 0) {
+    return ERR_TCP_TRANSPORT_CONNECTION_CLOSED_BY_FIN;
+  }
+  return ret;
+}
+
+int TlsSessionTransport::Write(esp_transport_handle_t transport, const char* buffer, int len, int timeout_ms) {
+  auto* const self = TlsSessionTransport::self(transport);
+  const auto poll = self->Poll(timeout_ms, true);
+  if (poll <= 0) {
+    return poll;
+  }
+
+  const auto ret = esp_tls_conn_write(self->tls_, buffer, len);
+  if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_WANT_WRITE) {
+    return 0;
+  }
+  return ret < 0 ? -1 : ret;
+}
+
+int TlsSessionTransport::PollRead(esp_transport_handle_t transport, int timeout_ms) {
+  return self(transport)->Poll(timeout_ms, false);
+}
+
+int TlsSessionTransport::PollWrite(esp_transport_handle_t transport, int timeout_ms) {
+  return self(transport)->Poll(timeout_ms, true);
+}
+
+int TlsSessionTransport::Close(esp_transport_handle_t transport) {
+  self(transport)->Close();
+  return 0;
+}
+
+int TlsSessionTransport::Destroy(esp_transport_handle_t transport) {
+  delete self(transport);
+  esp_transport_set_context_data(transport, nullptr);
+  return 0;
+}
+
+int TlsSessionTransport::Poll(const int timeout_ms, const bool write) {
+  if (tls_ == nullptr) {
+    return -1;
+  }
+
+  // Decrypted data already read from the socket would not wake select().
+  if (!write && esp_tls_get_bytes_avail(tls_) > 0) {
+    return 1;
+  }
+
+  int sockfd = -1;
+  if (esp_tls_get_conn_sockfd(tls_, &sockfd) != ESP_OK || sockfd < 0) {
+    return -1;
+  }
+
+  fd_set fds;
+  fd_set errors;
+  FD_ZERO(&fds);
+  FD_ZERO(&errors);
+  FD_SET(sockfd, &fds);
+  FD_SET(sockfd, &errors);
+  timeval timeout = {.tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000};
+  const auto ret = select(sockfd + 1, write ? nullptr : &fds, write ? &fds : nullptr, &errors, timeout_ms < 0 ? nullptr : &timeout);
+  if (ret > 0 && FD_ISSET(sockfd, &errors)) {
+    return -1;
+  }
+  return ret;
+}
+
+void TlsSessionTransport::Close() {
+  if (tls_ != nullptr) {
+    esp_tls_conn_destroy(tls_);
+    tls_ = nullptr;
+  }
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+#pragma once
+
+#ifndef _TLS_SESSION_TRANSPORT_H_
+#define _TLS_SESSION_TRANSPORT_H_
+
+#include <esp_err.h>
+#include <esp_transport.h>
+
+struct esp_tls;
+class TlsSessionCache;
+
+// An esp_transport like the ESP-IDF ssl one that resumes and saves sessions in |cache|, which must outlive it.
+class TlsSessionTransport {
+ public:
+  static esp_transport_handle_t Create(TlsSessionCache* cache, esp_err_t (*crt_bundle_attach)(void* conf));
+
+ private:
+  TlsSessionTransport(TlsSessionCache* cache, esp_err_t (*crt_bundle_attach)(void* conf));
+  ~TlsSessionTransport();
+  TlsSessionTransport(const TlsSessionTransport&) = delete;
+  TlsSessionTransport& operator=(const TlsSessionTransport&) = delete;
+
+  static TlsSessionTransport* self(esp_transport_handle_t transport);
+  static int Connect(esp_transport_handle_t transport, const char* host, int port, int timeout_ms);
+  static int Read(esp_transport_handle_t transport, char* buffer, int len, int timeout_ms);
+  static int Write(esp_transport_handle_t transport, const char* buffer, int len, int timeout_ms);
+  static int PollRead(esp_transport_handle_t transport, int timeout_ms);
+  static int PollWrite(esp_transport_handle_t transport, int timeout_ms);
+  static int Close(esp_transport_handle_t transport);
+  static int Destroy(esp_transport_handle_t transport);
+  int Poll(const int timeout_ms, const bool write);
+  void Close();
+
+  TlsSessionCache* const cache_ = nullptr;
+  esp_err_t (*const crt_bundle_attach_)(void* conf) = nullptr;
+  esp_tls* tls_ = nullptr;
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include "voice_activity_detector.h"
+
+#include <algorithm>
+
+namespace {
+constexpr uint32_t kMinimumWindowDuration = 500;    // ms, the noise floor rises after kMinimumWindows of them
+constexpr uint32_t kHangoverDuration = 300;         // ms
+constexpr uint32_t kMinNoiseFloor = 25 * 25;        // mean square, about -62 dBFS
+constexpr uint32_t kMinSpeechEnergy = 100 * 100;    // mean square, about -50 dBFS
+constexpr uint32_t kSpeechToNoiseRatio = 4;         // 6 dB above the noise floor
+constexpr uint32_t kLoudSpeechToNoiseRatio = 16;    // 12 dB above the noise floor, accepted whatever the zero crossings
+constexpr uint32_t kMaxSpeechZeroCrossings = 6400;  // per second, voiced speech stays well below, hiss goes above
+}  // namespace
+
+VoiceActivityDetector::VoiceActivityDetector(const uint32_t sample_rate, const uint32_t frame_duration, const uint32_t end_of_speech_duration)
+    : sample_rate_(sample_rate),
+      hangover_frames_((kHangoverDuration + frame_duration - 1) / frame_duration),
+      end_of_speech_frames_((end_of_speech_duration + frame_duration - 1) / frame_duration),
+      window_frames_(std::max<uint32_t>(1, kMinimumWindowDuration / frame_duration)),
+      noise_floor_(kMinNoiseFloor) {
+}
+
+VoiceActivityDetector::Result VoiceActivityDetector::Process(const int16_t* pcm, const size_t samples) {
+  if (samples == 0) {
+    return {speech_detected_ && silent_frames_ <= hangover_frames_, false};
+  }
+
+  uint64_t sum = 0;
+  uint32_t zero_crossings = 0;
+  for (size_t i = 0; i < samples; ++i) {
+    sum += static_cast<int32_t>(pcm[i]) * pcm[i];
+    if (i > 0 && (pcm[i] ^ pcm[i - 1]) < 0) {
+      ++zero_crossings;
+    }
+  }
+  const auto energy = static_cast<uint32_t>(sum / samples);
+  const auto zero_crossing_rate = static_cast<uint32_t>(zero_crossings * static_cast<uint64_t>(sample_rate_) / samples);
+
+  const auto floor = static_cast<uint64_t>(noise_floor_);
+  const bool speech = energy >= kMinSpeechEnergy &&
+                      (energy >= floor * kLoudSpeechToNoiseRatio ||
+                       (energy >= floor * kSpeechToNoiseRatio && zero_crossing_rate <= kMaxSpeechZeroCrossings));
+  TrackNoiseFloor(energy);
+
+  if (speech) {
+    speech_detected_ = true;
+    end_of_speech_reported_ = false;
+    silent_frames_ = 0;
+    return {true, false};
+  }
+
+  ++silent_frames_;
+  if (speech_detected_ && !end_of_speech_reported_ && end_of_speech_frames_ > 0 && silent_frames_ >= end_of_speech_frames_) {
+    end_of_speech_reported_ = true;
+    return {false, true};
+  }
+  return {speech_detected_ && silent_frames_ <= hangover_frames_, false};
+}
+
+void VoiceActivityDetector::Reset() {
+  silent_frames_ = 0;
+  speech_detected_ = false;
+  end_of_speech_reported_ = false;
+}
+
+void VoiceActivityDetector::TrackNoiseFloor(const uint32_t energy) {
+  noise_floor_ = std::max(std::min(noise_floor_, energy), kMinNoiseFloor);
+  window_minimum_ = std::min(window_minimum_, energy);
+  if (++window_frame_ < window_frames_) {
+    return;
+  }
+
+  window_minima_[window_count_++ % kMinimumWindows] = window_minimum_;
+  window_minimum_ = UINT32_MAX;
+  window_frame_ = 0;
+  // Only goes down until the first windows are seen, a stream starting with speech does not raise it.
+  if (window_count_ >= kMinimumWindows) {
+    noise_floor_ = std::max(*std::min_element(window_minima_.begin(), window_minima_.end()), kMinNoiseFloor);
+  }
+}
\ No newline at end of file
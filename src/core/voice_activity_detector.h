@@ -0,0 +1,48 @@
+#pragma once
+
+#ifndef _VOICE_ACTIVITY_DETECTOR_H_
+#define _VOICE_ACTIVITY_DETECTOR_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Integer-only VAD: frame energy against the noise floor of the last seconds, gated by the zero-crossing rate, with a hangover.
+class VoiceActivityDetector {
+ public:
+  struct Result {
+    bool speech;
+    bool end_of_speech;
+  };
+
+  // |end_of_speech_duration| is the silence in ms after speech that ends the utterance, 0 never reports the end of speech.
+  VoiceActivityDetector(const uint32_t sample_rate, const uint32_t frame_duration, const uint32_t end_of_speech_duration);
+
+  Result Process(const int16_t* pcm, const size_t samples);
+  // Starts a new utterance, the noise floor tracked so far is kept.
+  void Reset();
+
+ private:
+  VoiceActivityDetector(const VoiceActivityDetector&) = delete;
+  VoiceActivityDetector& operator=(const VoiceActivityDetector&) = delete;
+
+  static constexpr size_t kMinimumWindows = 4;
+
+  void TrackNoiseFloor(const uint32_t energy);
+
+  const uint32_t sample_rate_ = 0;
+  const uint32_t hangover_frames_ = 0;
+  const uint32_t end_of_speech_frames_ = 0;
+  const uint32_t window_frames_ = 0;
+  uint32_t noise_floor_ = 0;
+  // Minimum energy of each of the last windows, oldest overwritten first, and of the window in progress.
+  std::array<uint32_t, kMinimumWindows> window_minima_{};
+  size_t window_count_ = 0;
+  uint32_t window_minimum_ = UINT32_MAX;
+  uint32_t window_frame_ = 0;
+  uint32_t silent_frames_ = 0;
+  bool speech_detected_ = false;
+  bool end_of_speech_reported_ = false;
+};
+
+#endif
\ No newline at end of file
@@ -7,10 +7,11 @@
 #include <esp_wn_models.h>
 #include <model_path.h>
 
+#include <algorithm>
 #include <cstring>
 
+#include "core/audio_capture_service.h"
 #include "core/flex_array/flex_array.h"
-#include "core/silk_resampler.h"
 
 #ifndef CLOGGER_SEVERITY
 #define CLOGGER_SEVERITY CLOGGER_SEVERITY_WARN
@@ -24,11 +25,27 @@ constexpr uint8_t kSrmodels[] = {
 #include "srmodels.bin"
 };
 
-constexpr uint32_t kSampleRate = 16000;
+constexpr uint32_t kSampleRate = AudioCaptureService::kSampleRate;
+constexpr uint32_t kFeedRingChunks = 4;
+constexpr uint32_t kSpeechOnsetChunks = 6;  // consecutive speech fetches, about 200 ms, before |speech_handler_| is called
 }  // namespace
 
-WakeNet::WakeNet(std::function<void()> &&handler, std::shared_ptr<ai_vox::AudioInputDevice> audio_input_device)
-    : handler_(std::move(handler)), audio_input_device_(std::move(audio_input_device)) {
+WakeNet::WakeNet(std::shared_ptr<Executor> executor,
+                 std::function<void()> &&handler,
+                 std::shared_ptr<AudioCaptureService> capture_service,
+                 const uint32_t pre_roll_duration,
+                 const bool echo_cancellation,
+                 std::function<void()> &&speech_handler)
+    : handler_(std::move(handler)),
+      speech_handler_(std::move(speech_handler)),
+      echo_cancellation_(echo_cancellation),
+      capture_service_(std::move(capture_service)),
+      pre_roll_(kSampleRate / 1000 * pre_roll_duration) {
+  if (capture_service_->sample_rate() != kSampleRate) {
+    CLOGE("wakenet needs %" PRIu32 " Hz audio, capture runs at %" PRIu32 " Hz", kSampleRate, capture_service_->sample_rate());
+    abort();
+  }
+
   srmodel_list_t *models = srmodel_load(kSrmodels);
   if (models) {
     for (int i = 0; i < models->num; i++) {
@@ -40,10 +57,10 @@ WakeNet::WakeNet(std::function<void()> &&handler, std::shared_ptr<ai_vox::AudioI
 
   afe_config_t afe_config = AFE_CONFIG_DEFAULT();
   afe_config.wakenet_model_name = esp_srmodel_filter(models, ESP_WN_PREFIX, nullptr);
-  afe_config.aec_init = false;
-  afe_config.pcm_config.total_ch_num = 1;
+  afe_config.aec_init = echo_cancellation_;
+  afe_config.pcm_config.total_ch_num = echo_cancellation_ ? 2 : 1;
   afe_config.pcm_config.mic_num = 1;
-  afe_config.pcm_config.ref_num = 0;
+  afe_config.pcm_config.ref_num = echo_cancellation_ ? 1 : 0;
   afe_config.pcm_config.sample_rate = kSampleRate;
 
   afe_data_ = g_afe_handle.create_from_config(&afe_config);
@@ -52,56 +69,89 @@ WakeNet::WakeNet(std::function<void()> &&handler, std::shared_ptr<ai_vox::AudioI
     CLOGE("afe create failed");
     abort();
   }
+
+  feed_buffer_ = FlexArray<int16_t>(g_afe_handle.get_feed_chunksize(afe_data_) * g_afe_handle.get_total_channel_num(afe_data_));
+  pcm_ring_ = std::make_unique<SpscRingBuffer<int16_t>>(feed_buffer_.size() * kFeedRingChunks);
+  if (echo_cancellation_) {
+    interleave_buffer_ = FlexArray<int16_t>(capture_service_->chunk_samples() * 2);
+  }
+
+  // A priority above the uplink encoder's, the feed ring holds fewer chunks than its capture ring.
+  feed_strand_ = std::make_unique<Strand>(std::move(executor), Executor::Pool::kAudio, tskIDLE_PRIORITY + 2);
+  detect_task_ = std::make_unique<TaskQueue>("WakeNetDetect", 4 * 1024, tskIDLE_PRIORITY + 1);
 }
 
 WakeNet::~WakeNet() {
   Stop();
+  detect_task_.reset();
+  feed_strand_.reset();
   g_afe_handle.destroy(afe_data_);
 }
 
 void WakeNet::Start() {
   CLOGI();
 
-  if (detect_task_ != nullptr || feed_task_ != nullptr) {
+  if (started_) {
     CLOGD("WakeNet already started");
     return;
   }
 
-  audio_input_device_->OpenInput(kSampleRate);
-
-  if (audio_input_device_->input_sample_rate() != kSampleRate) {
-    resampler_ = std::make_unique<SilkResampler>(audio_input_device_->input_sample_rate(), kSampleRate);
-  }
-
-  feed_task_ = new TaskQueue("WakeNetFeed", 8 * 1024, tskIDLE_PRIORITY + 1);
-  detect_task_ = new TaskQueue("WakeNetDetect", 4 * 1024, tskIDLE_PRIORITY + 1);
+  started_ = true;
+  const auto epoch = detect_task_->epoch();
+  detect_task_->EnqueueInEpoch(epoch, [this, epoch]() {
+    speech_chunks_ = 0;
+    DetectWakeWord(epoch);
+  });
 
-  feed_task_->Enqueue(
-      [this, samples = g_afe_handle.get_feed_chunksize(afe_data_) * g_afe_handle.get_total_channel_num(afe_data_)]() mutable { FeedData(samples); });
-  detect_task_->Enqueue([this]() { DetectWakeWord(); });
+  subscription_ = capture_service_->Subscribe(
+      [this](const int16_t *pcm, const int16_t *reference, const size_t samples) { OnCapturedPcm(pcm, reference, samples); });
   CLOGI("OK");
 }
 
 void WakeNet::Stop() {
-  delete feed_task_;
-  feed_task_ = nullptr;
-
-  delete detect_task_;
-  detect_task_ = nullptr;
+  if (!started_) {
+    return;
+  }
 
-  resampler_.reset();
-  audio_input_device_->CloseInput();
+  capture_service_->Unsubscribe(subscription_);
+  // The detection loop ends after the fetch in progress, a restarted loop runs once it has.
+  detect_task_->NewEpoch();
+  feed_strand_->Enqueue([this]() { pcm_ring_->Clear(); });
+  started_ = false;
   CLOGI("OK");
 }
 
-void WakeNet::FeedData(const uint32_t samples) {
-  auto pcm = ReadPcm(samples);
-  g_afe_handle.feed(afe_data_, pcm.data());
+void WakeNet::OnCapturedPcm(const int16_t *pcm, const int16_t *reference, const size_t samples) {
+  // Runs on the capture task: copy and wake the feed task, the AFE runs there.
+  AppendPreRoll(pcm, samples);
+
+  if (!echo_cancellation_) {
+    pcm_ring_->Write(pcm, samples);
+  } else {
+    // One microphone then one reference sample per frame, the layout of the AFE with mic_num = 1 and ref_num = 1.
+    const auto frames = std::min(samples, interleave_buffer_.size() / 2);
+    auto *interleaved = interleave_buffer_.data();
+    for (size_t i = 0; i < frames; ++i) {
+      interleaved[2 * i] = pcm[i];
+      interleaved[2 * i + 1] = reference != nullptr ? reference[i] : 0;
+    }
+    pcm_ring_->Write(interleaved, frames * 2);
+  }
+
+  if (!feed_scheduled_.exchange(true)) {
+    feed_strand_->Enqueue([this]() { FeedData(); });
+  }
+}
 
-  feed_task_->Enqueue([this, samples]() mutable { FeedData(samples); });
+void WakeNet::FeedData() {
+  // Cleared first, a chunk captured from now on schedules another run.
+  feed_scheduled_ = false;
+  while (pcm_ring_->Read(feed_buffer_.data(), feed_buffer_.size())) {
+    g_afe_handle.feed(afe_data_, feed_buffer_.data());
+  }
 }
 
-void WakeNet::DetectWakeWord() {
+void WakeNet::DetectWakeWord(const uint32_t epoch) {
   afe_fetch_result_t *res = g_afe_handle.fetch(afe_data_);
   if (res != nullptr && res->wakeup_state == WAKENET_DETECTED) {
     CLOGI("Wake word detected");
@@ -109,18 +159,55 @@ void WakeNet::DetectWakeWord() {
       handler_();
     }
   }
+
+  if (res != nullptr && res->ret_value != ESP_FAIL && res->data != nullptr) {
+    Publish(res->data, nullptr, res->data_size / sizeof(int16_t));
+    if (res->vad_state == AFE_VAD_SPEECH) {
+      if (++speech_chunks_ == kSpeechOnsetChunks && speech_handler_) {
+        CLOGI("speech detected");
+        speech_handler_();
+      }
+    } else {
+      speech_chunks_ = 0;
+    }
+  }
   taskYIELD();
-  detect_task_->Enqueue([this]() { DetectWakeWord(); });
+  detect_task_->EnqueueInEpoch(epoch, [this, epoch]() { DetectWakeWord(epoch); });
 }
 
-FlexArray<int16_t> WakeNet::ReadPcm(const uint32_t samples) {
-  FlexArray<int16_t> pcm(samples);
-  audio_input_device_->Read(pcm.data(), pcm.size());
-  if (resampler_) {
-    return resampler_->Resample(std::move(pcm));
-  } else {
-    return pcm;
+void WakeNet::TakePreRoll(const std::function<void(const int16_t *pcm, const size_t samples)> &handler) {
+  std::lock_guard lock(pre_roll_mutex_);
+  if (pre_roll_size_ > 0 && handler) {
+    const auto start = (pre_roll_write_ + pre_roll_.size() - pre_roll_size_) % pre_roll_.size();
+    const auto first = std::min(pre_roll_size_, pre_roll_.size() - start);
+    handler(pre_roll_.data() + start, first);
+    if (first < pre_roll_size_) {
+      handler(pre_roll_.data(), pre_roll_size_ - first);
+    }
   }
+  pre_roll_write_ = 0;
+  pre_roll_size_ = 0;
+}
+
+void WakeNet::AppendPreRoll(const int16_t *pcm, const size_t samples) {
+  const auto capacity = pre_roll_.size();
+  if (capacity == 0) {
+    return;
+  }
+
+  std::lock_guard lock(pre_roll_mutex_);
+  if (samples >= capacity) {
+    memcpy(pre_roll_.data(), pcm + samples - capacity, capacity * sizeof(int16_t));
+    pre_roll_write_ = 0;
+    pre_roll_size_ = capacity;
+    return;
+  }
+
+  const auto first = std::min(samples, capacity - pre_roll_write_);
+  memcpy(pre_roll_.data() + pre_roll_write_, pcm, first * sizeof(int16_t));
+  memcpy(pre_roll_.data(), pcm + first, (samples - first) * sizeof(int16_t));
+  pre_roll_write_ = (pre_roll_write_ + samples) % capacity;
+  pre_roll_size_ = std::min(pre_roll_size_ + samples, capacity);
 }
 
 #endif  // ARDUINO_ESP32S3_DEV
\ No newline at end of file
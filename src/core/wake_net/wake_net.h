@@ -3,36 +3,62 @@
 #ifndef _WAKE_NET_H_
 #define _WAKE_NET_H_
 
+#include <atomic>
 #include <functional>
 #include <memory>
+#include <mutex>
 
-#include "audio_device/audio_input_device.h"
+#include "core/audio_source.h"
+#include "core/executor/executor.h"
 #include "core/flex_array/flex_array.h"
+#include "core/spsc_ring_buffer/spsc_ring_buffer.h"
 #include "core/task_queue/task_queue.h"
 
 struct esp_afe_sr_data_t;
-class SilkResampler;
+class AudioCaptureService;
 
-class WakeNet {
+// Runs the ESP-SR front end and wake word model on the captured audio and publishes its output. |echo_cancellation| feeds the
+// playback reference to the AEC and calls |speech_handler| on speech.
+class WakeNet : public AudioSource {
  public:
-  explicit WakeNet(std::function<void()>&& handler, std::shared_ptr<ai_vox::AudioInputDevice> audio_input_device);
+  explicit WakeNet(std::shared_ptr<Executor> executor,
+                   std::function<void()>&& handler,
+                   std::shared_ptr<AudioCaptureService> capture_service,
+                   const uint32_t pre_roll_duration,
+                   const bool echo_cancellation = false,
+                   std::function<void()>&& speech_handler = nullptr);
   ~WakeNet();
   void Start();
   void Stop();
+  // Hands the pre-roll to |handler|, oldest first, in at most two calls, and empties it.
+  void TakePreRoll(const std::function<void(const int16_t* pcm, const size_t samples)>& handler);
 
  private:
   WakeNet(const WakeNet&) = delete;
   WakeNet& operator=(const WakeNet&) = delete;
-  void FeedData(const uint32_t samples);
-  void DetectWakeWord();
-  FlexArray<int16_t> ReadPcm(const uint32_t samples);
+  void OnCapturedPcm(const int16_t* pcm, const int16_t* reference, const size_t samples);
+  void FeedData();
+  void DetectWakeWord(const uint32_t epoch);
+  void AppendPreRoll(const int16_t* pcm, const size_t samples);
 
   std::function<void()> handler_;
-  std::shared_ptr<ai_vox::AudioInputDevice> audio_input_device_;
-  TaskQueue* detect_task_ = nullptr;
-  TaskQueue *feed_task_ = nullptr;
-  std::unique_ptr<SilkResampler> resampler_;
+  std::function<void()> speech_handler_;
+  const bool echo_cancellation_ = false;
+  std::shared_ptr<AudioCaptureService> capture_service_;
+  std::unique_ptr<Strand> feed_strand_;
+  std::unique_ptr<TaskQueue> detect_task_;
   esp_afe_sr_data_t* afe_data_ = nullptr;
+  std::unique_ptr<SpscRingBuffer<int16_t>> pcm_ring_;
+  std::atomic<bool> feed_scheduled_ = false;
+  bool started_ = false;
+  FlexArray<int16_t> feed_buffer_;
+  FlexArray<int16_t> interleave_buffer_;
+  uint32_t subscription_ = 0;
+  uint32_t speech_chunks_ = 0;
+  std::mutex pre_roll_mutex_;
+  FlexArray<int16_t> pre_roll_;
+  size_t pre_roll_write_ = 0;
+  size_t pre_roll_size_ = 0;
 };
 
 #endif  // _WAKE_NET_H_
\ No newline at end of file
@@ -0,0 +1,133 @@
+#include "websocket_message_assembler.h"
+
+#include <cstring>
+
+#ifndef CLOGGER_SEVERITY
+#define CLOGGER_SEVERITY CLOGGER_SEVERITY_WARN
+#endif
+#include "clogger/clogger.h"
+
+namespace {
+constexpr uint8_t kContinuationFrame = 0x00;
+constexpr uint8_t kTextFrame = 0x01;
+constexpr uint8_t kBinaryFrame = 0x02;
+}  // namespace
+
+WebsocketMessageAssembler::WebsocketMessageAssembler(const size_t max_message_size,
+                                                     BufferPool* text_pool,
+                                                     BufferPool* binary_pool,
+                                                     MessageHandler&& message_handler,
+                                                     DropHandler&& drop_handler)
+    : max_message_size_(max_message_size),
+      text_pool_(text_pool),
+      binary_pool_(binary_pool),
+      message_handler_(std::move(message_handler)),
+      drop_handler_(std::move(drop_handler)) {
+}
+
+void WebsocketMessageAssembler::OnData(const esp_websocket_event_data_t& data) {
+  if (data.op_code != kContinuationFrame && data.op_code != kTextFrame && data.op_code != kBinaryFrame) {
+    return;
+  }
+
+  if (data.payload_offset == 0 && !StartFrame(data)) {
+    return;
+  }
+
+  if (op_code_ == 0) {
+    return;
+  }
+
+  const auto payload_len = static_cast<size_t>(data.payload_len);
+  const auto offset = static_cast<size_t>(data.payload_offset);
+  const auto length = static_cast<size_t>(data.data_len);
+  if (!dropping_) {
+    if (offset + length > payload_len) {
+      CLOGW("websocket chunk out of its frame: %zu + %zu > %zu", offset, length, payload_len);
+      dropping_ = true;
+      message_ = FlexArray<uint8_t>();
+    } else {
+      memcpy(message_.data() + frame_base_ + offset, data.data_ptr, length);
+    }
+  }
+
+  if (offset + length < payload_len) {
+    return;
+  }
+
+  frame_base_ += payload_len;
+  if (!data.fin) {
+    return;
+  }
+
+  if (dropping_) {
+    Drop();
+  } else {
+    const auto op_code = op_code_;
+    op_code_ = 0;
+    message_handler_(op_code, std::move(message_));
+  }
+}
+
+void WebsocketMessageAssembler::Reset() {
+  message_ = FlexArray<uint8_t>();
+  op_code_ = 0;
+  frame_base_ = 0;
+  dropping_ = false;
+}
+
+bool WebsocketMessageAssembler::StartFrame(const esp_websocket_event_data_t& data) {
+  const auto payload_len = static_cast<size_t>(data.payload_len);
+  if (data.op_code == kContinuationFrame) {
+    if (op_code_ == 0) {
+      CLOGW("websocket continuation frame without a message");
+      return false;
+    }
+  } else {
+    if (op_code_ != 0) {
+      CLOGW("websocket message interrupted by a new one");
+      Drop();
+    }
+    op_code_ = data.op_code;
+    frame_base_ = 0;
+    dropping_ = false;
+    message_ = FlexArray<uint8_t>();
+  }
+
+  if (dropping_) {
+    return true;
+  }
+
+  if (frame_base_ + payload_len > max_message_size_) {
+    CLOGW("websocket message over %zu bytes dropped", max_message_size_);
+    dropping_ = true;
+    message_ = FlexArray<uint8_t>();
+    return true;
+  }
+
+  // The first frame is usually the whole message, it gets a buffer of its size and later frames grow it.
+  bool allocated = false;
+  if (frame_base_ == 0) {
+    message_ = FlexArray<uint8_t>(op_code_ == kTextFrame ? text_pool_ : binary_pool_, payload_len);
+    allocated = message_.data() != nullptr || payload_len == 0;
+  } else {
+    allocated = message_.Resize(frame_base_ + payload_len);
+  }
+
+  // Dropped whole like an oversized message, the connection goes on.
+  if (!allocated) {
+    CLOGE("no memory for a websocket message of %zu bytes", frame_base_ + payload_len);
+    dropping_ = true;
+    message_ = FlexArray<uint8_t>();
+  }
+  return true;
+}
+
+void WebsocketMessageAssembler::Drop() {
+  const auto op_code = op_code_;
+  Reset();
+  ++dropped_count_;
+  if (drop_handler_) {
+    drop_handler_(op_code);
+  }
+}
\ No newline at end of file
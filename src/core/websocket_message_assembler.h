@@ -0,0 +1,53 @@
+#pragma once
+
+#ifndef _WEBSOCKET_MESSAGE_ASSEMBLER_H_
+#define _WEBSOCKET_MESSAGE_ASSEMBLER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "espressif_esp_websocket_client/esp_websocket_client.h"
+#include "flex_array/flex_array.h"
+
+// Rebuilds whole messages from the WEBSOCKET_EVENT_DATA events, split frames and fragments alike. Messages over
+// |max_message_size|, or out of memory, are dropped and reported to |drop_handler|.
+class WebsocketMessageAssembler {
+ public:
+  using MessageHandler = std::function<void(const uint8_t op_code, FlexArray<uint8_t>&& message)>;
+  using DropHandler = std::function<void(const uint8_t op_code)>;
+
+  WebsocketMessageAssembler(const size_t max_message_size,
+                            BufferPool* text_pool,
+                            BufferPool* binary_pool,
+                            MessageHandler&& message_handler,
+                            DropHandler&& drop_handler);
+
+  void OnData(const esp_websocket_event_data_t& data);
+  // Forgets a message cut by a disconnection.
+  void Reset();
+
+  uint32_t dropped_count() const {
+    return dropped_count_;
+  }
+
+ private:
+  WebsocketMessageAssembler(const WebsocketMessageAssembler&) = delete;
+  WebsocketMessageAssembler& operator=(const WebsocketMessageAssembler&) = delete;
+
+  bool StartFrame(const esp_websocket_event_data_t& data);
+  void Drop();
+
+  const size_t max_message_size_ = 0;
+  BufferPool* const text_pool_ = nullptr;
+  BufferPool* const binary_pool_ = nullptr;
+  const MessageHandler message_handler_;
+  const DropHandler drop_handler_;
+  FlexArray<uint8_t> message_;
+  uint8_t op_code_ = 0;  // of the message being assembled, 0 when there is none
+  size_t frame_base_ = 0;
+  bool dropping_ = false;
+  uint32_t dropped_count_ = 0;
+};
+
+#endif
\ No newline at end of file